@@ -0,0 +1,271 @@
+/*
+ *  alloc_stats - memory allocation statistics of libacars decoders
+ *
+ *  Copyright (c) 2018-2023 Tomasz Lemiech <szpajder@gmail.com>
+ */
+#include <stdbool.h>            /* true, false */
+#include <stdio.h>              /* printf(), fprintf(), fgets(), fopen() */
+#include <stdlib.h>             /* malloc(), realloc(), exit() */
+#include <string.h>             /* strcmp(), strchr(), strlen(), memcpy() */
+#include <libacars/libacars.h>  /* la_proto_node, la_msg_dir, la_alloc_stats_*(),
+                                   la_proto_tree_format_text(), la_proto_tree_destroy() */
+#include <libacars/acars.h>     /* la_acars_decode_apps() */
+#include <libacars/arena.h>     /* la_arena_*() */
+#include <libacars/vstring.h>   /* la_vstring, la_vstring_destroy() */
+
+#define MAX_TYPE_LEN 64
+
+typedef struct {
+	char label[3];
+	la_msg_dir msg_dir;
+	char *txt;
+} message;
+
+typedef struct {
+	char name[MAX_TYPE_LEN];
+	unsigned long msg_cnt;
+	la_alloc_stats total;
+	uint64_t module_allocs[LA_ALLOC_MODULE_MAX + 1];
+} type_stats;
+
+message *messages = NULL;
+size_t message_cnt = 0;
+type_stats *types = NULL;
+size_t type_cnt = 0;
+
+void usage() {
+	fprintf(stderr,
+			"alloc_stats - memory allocation statistics of libacars decoders\n"
+			"(c) 2018-2023 Tomasz Lemiech <szpajder@gmail.com>\n\n"
+			"Usage: ./alloc_stats [-b <baseline_file>] [-w <baseline_file>] < messages.txt\n\n"
+			"Decodes messages read from standard input (in the format accepted by\n"
+			"decode_acars_apps), formats them as text and JSON and reports the average\n"
+			"number of memory allocations per message, per message type and per\n"
+			"libacars module. Then it decodes all messages again into a memory arena\n"
+			"and verifies that, once the arena has grown to its working size, decoding\n"
+			"does not allocate any memory from the heap.\n\n"
+			"Options:\n"
+			"\t-w <baseline_file>\twrite allocation counts per message type to a file\n"
+			"\t-b <baseline_file>\tcompare allocation counts with a file produced by -w\n"
+			"\t\t\t\tand fail if any message type allocates more\n\n"
+			"Exit code is 0 on success and 1 if any check has failed.\n"
+			"libacars must be built with ALLOC_STATS option enabled.\n"
+			);
+}
+
+void read_messages(FILE *f) {
+	char buf[10240];
+	while(fgets(buf, sizeof(buf), f) != NULL) {
+		char *end = strchr(buf, '\n');
+		if(end)
+			*end = '\0';
+		if(strlen(buf) < 6 || (buf[0] != 'u' && buf[0] != 'd') || buf[1] != ' ' ||
+				buf[2] == ' ' || buf[3] == ' ' || buf[4] != ' ') {
+			fprintf(stderr, "Garbled input: expecting 'u|d label acars_message_text'\n");
+			continue;
+		}
+		messages = realloc(messages, (message_cnt + 1) * sizeof(message));
+		message *m = messages + message_cnt++;
+		m->msg_dir = buf[0] == 'u' ? LA_MSG_DIR_GND2AIR : LA_MSG_DIR_AIR2GND;
+		m->label[0] = buf[2];
+		m->label[1] = buf[3];
+		m->label[2] = '\0';
+		size_t len = strlen(buf + 5);
+		m->txt = malloc(len + 1);
+		memcpy(m->txt, buf + 5, len + 1);
+	}
+}
+
+la_proto_node *decode(message const *m) {
+	int offset = la_acars_extract_sublabel_and_mfi(m->label, m->msg_dir, m->txt,
+			strlen(m->txt), NULL, NULL);
+	return la_acars_decode_apps(m->label, m->txt + offset, m->msg_dir);
+}
+
+// Message type is a dot-separated list of protocols found in the decoded tree
+void get_type_name(la_proto_node const *node, char *result) {
+	strcpy(result, node != NULL ? "" : "(undecoded)");
+	for(; node != NULL; node = node->next) {
+		if(node->td == NULL || node->td->json_key == NULL) {
+			continue;
+		}
+		if(result[0] != '\0' && strlen(result) + 1 < MAX_TYPE_LEN) {
+			strcat(result, ".");
+		}
+		strncat(result, node->td->json_key, MAX_TYPE_LEN - strlen(result) - 1);
+	}
+}
+
+type_stats *get_type_stats(char const *name) {
+	for(size_t i = 0; i < type_cnt; i++) {
+		if(!strcmp(types[i].name, name)) {
+			return types + i;
+		}
+	}
+	types = realloc(types, (type_cnt + 1) * sizeof(type_stats));
+	type_stats *t = types + type_cnt++;
+	memset(t, 0, sizeof(type_stats));
+	strcpy(t->name, name);
+	return t;
+}
+
+void collect_heap_stats() {
+	char name[MAX_TYPE_LEN];
+	la_alloc_stats st;
+	for(size_t i = 0; i < message_cnt; i++) {
+		la_alloc_stats_reset();
+		la_proto_node *node = decode(messages + i);
+		if(node != NULL) {
+			la_vstring_destroy(la_proto_tree_format_text(NULL, node), true);
+			la_vstring_destroy(la_proto_tree_format_json(NULL, node), true);
+		}
+		get_type_name(node, name);
+		la_proto_tree_destroy(node);
+
+		type_stats *t = get_type_stats(name);
+		t->msg_cnt++;
+		for(int mod = 0; mod <= LA_ALLOC_MODULE_MAX; mod++) {
+			la_alloc_stats_get(mod, &st);
+			t->total.allocs += st.allocs;
+			t->total.reallocs += st.reallocs;
+			t->total.frees += st.frees;
+			t->total.bytes += st.bytes;
+			t->module_allocs[mod] += st.allocs + st.reallocs;
+		}
+	}
+}
+
+double allocs_per_msg(type_stats const *t) {
+	return (double)(t->total.allocs + t->total.reallocs) / t->msg_cnt;
+}
+
+void print_heap_stats() {
+	printf("%-40s %6s %10s %10s %10s\n", "Message type", "Count", "Allocs/msg", "Frees/msg", "Bytes/msg");
+	for(size_t i = 0; i < type_cnt; i++) {
+		type_stats const *t = types + i;
+		printf("%-40s %6lu %10.2f %10.2f %10.1f\n", t->name, t->msg_cnt, allocs_per_msg(t),
+				(double)t->total.frees / t->msg_cnt, (double)t->total.bytes / t->msg_cnt);
+		for(int mod = 0; mod <= LA_ALLOC_MODULE_MAX; mod++) {
+			if(t->module_allocs[mod] > 0) {
+				printf("    %-36s %17.2f\n", la_alloc_module_name_get(mod),
+						(double)t->module_allocs[mod] / t->msg_cnt);
+			}
+		}
+	}
+}
+
+// Decodes all messages into an arena twice and returns the number
+// of heap allocations made in the second pass.
+uint64_t count_arena_heap_allocs() {
+	la_arena *arena = la_arena_new(0);
+	la_alloc_stats st;
+	uint64_t heap_allocs = 0;
+	for(int pass = 0; pass < 2; pass++) {
+		la_alloc_stats_reset();
+		for(size_t i = 0; i < message_cnt; i++) {
+			la_arena_set(arena);
+			la_proto_node *node = decode(messages + i);
+			if(node != NULL) {
+				(void)la_proto_tree_format_text(NULL, node);
+				(void)la_proto_tree_format_json(NULL, node);
+			}
+			la_arena_set(NULL);
+			la_arena_reset(arena);
+		}
+	}
+	for(int mod = 0; mod <= LA_ALLOC_MODULE_MAX; mod++) {
+		la_alloc_stats_get(mod, &st);
+		heap_allocs += st.heap_allocs;
+	}
+	la_arena_destroy(arena);
+	return heap_allocs;
+}
+
+void write_baseline(char const *file) {
+	FILE *f = fopen(file, "w");
+	if(f == NULL) {
+		perror(file);
+		exit(1);
+	}
+	for(size_t i = 0; i < type_cnt; i++) {
+		fprintf(f, "%s %.2f\n", types[i].name, allocs_per_msg(types + i));
+	}
+	fclose(f);
+}
+
+bool check_baseline(char const *file) {
+	FILE *f = fopen(file, "r");
+	if(f == NULL) {
+		perror(file);
+		exit(1);
+	}
+	bool result = true;
+	char name[MAX_TYPE_LEN];
+	double expected = 0.0;
+	while(fscanf(f, "%63s %lf", name, &expected) == 2) {
+		for(size_t i = 0; i < type_cnt; i++) {
+			if(strcmp(types[i].name, name)) {
+				continue;
+			}
+			double actual = allocs_per_msg(types + i);
+			if(actual > expected + 0.005) {
+				printf("REGRESSION: %s: %.2f allocations per message (baseline: %.2f)\n",
+						name, actual, expected);
+				result = false;
+			}
+		}
+	}
+	fclose(f);
+	return result;
+}
+
+int main(int argc, char **argv) {
+	char *baseline_in = NULL, *baseline_out = NULL;
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "-b") && i + 1 < argc) {
+			baseline_in = argv[++i];
+		} else if(!strcmp(argv[i], "-w") && i + 1 < argc) {
+			baseline_out = argv[++i];
+		} else {
+			usage();
+			exit(strcmp(argv[i], "-h") ? 1 : 0);
+		}
+	}
+	la_alloc_stats st;
+	if(la_alloc_stats_get(LA_ALLOC_MODULE_OTHER, &st) == false) {
+		fprintf(stderr, "libacars has been built without ALLOC_STATS option\n");
+		exit(1);
+	}
+	read_messages(stdin);
+	if(message_cnt == 0) {
+		fprintf(stderr, "No messages read from standard input. Use '-h' option for help.\n");
+		exit(1);
+	}
+
+	// Decode everything once, so that one-time initialization
+	// (eg. of configuration) does not count.
+	la_arena *arena = la_arena_new(0);
+	la_arena_set(arena);
+	for(size_t i = 0; i < message_cnt; i++) {
+		(void)decode(messages + i);
+	}
+	la_arena_destroy(arena);
+
+	bool ok = true;
+	collect_heap_stats();
+	print_heap_stats();
+	if(baseline_out != NULL) {
+		write_baseline(baseline_out);
+	}
+	if(baseline_in != NULL && check_baseline(baseline_in) == false) {
+		ok = false;
+	}
+	uint64_t heap_allocs = count_arena_heap_allocs();
+	printf("Heap allocations when decoding into an arena (steady state): %llu\n",
+			(unsigned long long)heap_allocs);
+	if(heap_allocs > 0) {
+		printf("REGRESSION: decoding into an arena allocates memory from the heap\n");
+		ok = false;
+	}
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,196 @@
+/*
+ *  decode_parallel - decodes ACARS applications in multiple threads
+ *
+ *  Copyright (c) 2018-2023 Tomasz Lemiech <szpajder@gmail.com>
+ */
+#include <stdbool.h>            /* true, false */
+#include <stdio.h>              /* printf(), fprintf(), fgets() */
+#include <stdlib.h>             /* malloc(), realloc(), calloc(), atoi(), exit() */
+#include <string.h>             /* strcmp(), strchr(), strlen(), memcpy() */
+#include <pthread.h>            /* pthread_create(), pthread_join() */
+#include <libacars/libacars.h>  /* la_proto_node, la_msg_dir, la_decoder_config_*(),
+                                   la_proto_tree_format_*(), la_proto_tree_destroy() */
+#include <libacars/acars.h>     /* la_acars_decode_apps() */
+#include <libacars/arena.h>     /* la_arena_*() */
+#include <libacars/vstring.h>   /* la_vstring, la_vstring_destroy() */
+
+#define DEFAULT_THREAD_CNT 8
+#define DEFAULT_REPEAT_CNT 100
+
+typedef struct {
+	char label[3];
+	la_msg_dir msg_dir;
+	char *txt;
+} message;
+
+typedef struct {
+	char const *text;
+	char const *json;
+} result;
+
+typedef struct {
+	pthread_t tid;
+	int id;
+	result *results;            /* results of the first decoding of each message */
+	unsigned long decoded;
+	unsigned long mismatches;
+} worker;
+
+message *messages = NULL;
+size_t message_cnt = 0;
+int repeat_cnt = DEFAULT_REPEAT_CNT;
+
+void usage() {
+	fprintf(stderr,
+			"decode_parallel - decodes ACARS applications in multiple threads\n"
+			"(c) 2018-2023 Tomasz Lemiech <szpajder@gmail.com>\n\n"
+			"Usage: ./decode_parallel [-t <thread_count>] [-r <repeat_count>] < messages.txt\n\n"
+			"Decodes messages read from standard input (in the format accepted by\n"
+			"decode_acars_apps) repeat_count times (default: %d) in each of\n"
+			"thread_count threads (default: %d) simultaneously. Every thread processes\n"
+			"messages in a different order. Half of the threads decode messages into\n"
+			"memory arenas and half of them use thread-local decoder settings. Text\n"
+			"and JSON results must be the same every time and in every thread.\n\n"
+			"Exit code is 0 on success and 1 if any result has been different.\n\n"
+			"To find data races in libacars, build it with ThreadSanitizer, eg.:\n\n"
+			"\tcmake -DCMAKE_BUILD_TYPE=Debug -DCMAKE_C_FLAGS=-fsanitize=thread ..\n",
+			DEFAULT_REPEAT_CNT, DEFAULT_THREAD_CNT
+			);
+}
+
+char *copy_string(char const *s) {
+	size_t len = strlen(s);
+	char *result = malloc(len + 1);
+	memcpy(result, s, len + 1);
+	return result;
+}
+
+void read_messages(FILE *f) {
+	char buf[10240];
+	while(fgets(buf, sizeof(buf), f) != NULL) {
+		char *end = strchr(buf, '\n');
+		if(end)
+			*end = '\0';
+		if(strlen(buf) < 6 || (buf[0] != 'u' && buf[0] != 'd') || buf[1] != ' ' ||
+				buf[2] == ' ' || buf[3] == ' ' || buf[4] != ' ') {
+			fprintf(stderr, "Garbled input: expecting 'u|d label acars_message_text'\n");
+			continue;
+		}
+		messages = realloc(messages, (message_cnt + 1) * sizeof(message));
+		message *m = messages + message_cnt++;
+		memset(m, 0, sizeof(message));
+		m->msg_dir = buf[0] == 'u' ? LA_MSG_DIR_GND2AIR : LA_MSG_DIR_AIR2GND;
+		m->label[0] = buf[2];
+		m->label[1] = buf[3];
+		m->label[2] = '\0';
+		m->txt = copy_string(buf + 5);
+	}
+}
+
+bool result_equal(result const *r1, result const *r2) {
+	return !strcmp(r1->text, r2->text) && !strcmp(r1->json, r2->json);
+}
+
+// Decodes the message and formats the result as text and JSON.
+// If expected->text is NULL, the result is stored in *expected.
+// Otherwise returns false if the result differs from *expected.
+bool decode(message const *m, result *expected) {
+	int offset = la_acars_extract_sublabel_and_mfi(m->label, m->msg_dir, m->txt,
+			strlen(m->txt), NULL, NULL);
+	la_proto_node *node = la_acars_decode_apps(m->label, m->txt + offset, m->msg_dir);
+	la_vstring *text = node != NULL ? la_proto_tree_format_text(NULL, node) : NULL;
+	la_vstring *json = node != NULL ? la_proto_tree_format_json(NULL, node) : NULL;
+	result r = {
+		.text = text != NULL ? text->str : "",
+		.json = json != NULL ? json->str : ""
+	};
+	bool ok = true;
+	if(expected->text == NULL) {
+		expected->text = copy_string(r.text);
+		expected->json = copy_string(r.json);
+	} else {
+		ok = result_equal(expected, &r);
+	}
+	la_vstring_destroy(text, true);
+	la_vstring_destroy(json, true);
+	la_proto_tree_destroy(node);
+	return ok;
+}
+
+void *worker_thread(void *ctx) {
+	worker *w = ctx;
+	la_arena *arena = NULL;
+	la_decoder_config config;
+	if(w->id % 2 == 0) {
+		arena = la_arena_new(0);
+	} else {
+		la_decoder_config_init(&config);
+		la_decoder_config_set(&config);
+	}
+	for(int r = 0; r < repeat_cnt; r++) {
+		for(size_t i = 0; i < message_cnt; i++) {
+			size_t idx = (i + w->id) % message_cnt;
+			la_arena_set(arena);
+			if(decode(messages + idx, w->results + idx) == false) {
+				w->mismatches++;
+			}
+			w->decoded++;
+			la_arena_set(NULL);
+			if(arena != NULL) {
+				la_arena_reset(arena);
+			}
+		}
+	}
+	la_decoder_config_set(NULL);
+	la_arena_destroy(arena);
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+	int thread_cnt = DEFAULT_THREAD_CNT;
+	for(int i = 1; i < argc; i++) {
+		if(!strcmp(argv[i], "-t") && i + 1 < argc) {
+			thread_cnt = atoi(argv[++i]);
+		} else if(!strcmp(argv[i], "-r") && i + 1 < argc) {
+			repeat_cnt = atoi(argv[++i]);
+		} else {
+			usage();
+			exit(strcmp(argv[i], "-h") ? 1 : 0);
+		}
+	}
+	if(thread_cnt < 1 || repeat_cnt < 1) {
+		fprintf(stderr, "Thread count and repeat count must be positive\n");
+		exit(1);
+	}
+	read_messages(stdin);
+	if(message_cnt == 0) {
+		fprintf(stderr, "No messages read from standard input. Use '-h' option for help.\n");
+		exit(1);
+	}
+
+	// Do not decode anything before starting threads, so that one-time
+	// initialization of the library is also performed concurrently.
+	worker *workers = calloc(thread_cnt, sizeof(worker));
+	for(int i = 0; i < thread_cnt; i++) {
+		workers[i].id = i;
+		workers[i].results = calloc(message_cnt, sizeof(result));
+		if(pthread_create(&workers[i].tid, NULL, worker_thread, workers + i) != 0) {
+			fprintf(stderr, "Could not create thread %d\n", i);
+			exit(1);
+		}
+	}
+	unsigned long decoded = 0, mismatches = 0;
+	for(int i = 0; i < thread_cnt; i++) {
+		pthread_join(workers[i].tid, NULL);
+		decoded += workers[i].decoded;
+		mismatches += workers[i].mismatches;
+		for(size_t j = 0; j < message_cnt; j++) {
+			if(result_equal(workers[i].results + j, workers[0].results + j) == false) {
+				mismatches++;
+			}
+		}
+	}
+	printf("Threads: %d, messages decoded: %lu, mismatched results: %lu\n",
+			thread_cnt, decoded, mismatches);
+	return mismatches > 0 ? 1 : 0;
+}
@@ -0,0 +1,263 @@
+/*
+ *  This file is a part of libacars
+ *
+ *  Copyright (c) 2018-2023 Tomasz Lemiech <szpajder@gmail.com>
+ */
+
+#include <stdint.h>
+#include <string.h>                         // memcpy
+#include "config.h"                         // HAVE_SYS_TIME_H
+#ifdef HAVE_SYS_TIME_H
+#include <sys/time.h>                       // struct timeval
+#endif
+#include <libacars/macros.h>                // la_assert
+#include <libacars/util.h>                  // LA_HEAP_XCALLOC, LA_HEAP_XREALLOC, LA_XFREE
+#include <libacars/acars.h>                 // la_acars_parse_and_reassemble
+#include <libacars/acars-merge.h>
+
+// Merges several streams of timestamped ACARS frames into a single stream
+// ordered by rx_time and feeds it into the decoder. This is required when
+// reassembly is performed in a single context for frames coming from
+// several receivers (or archive files), because reassembly timeouts are
+// evaluated against rx_time of the frame being processed.
+//
+// Frames are held in a min-heap ordered by rx_time. A frame is released when:
+//
+// - every open stream has already delivered a frame with the same or later
+//   rx_time (ie. the frame is older than the watermark), assuming that each
+//   stream on its own is ordered, or
+//
+// - it is older than the newest frame seen in any stream by more than the
+//   reorder window. This bounds the latency when some streams are quiet.
+
+typedef struct {
+	int64_t rx_usec;                    /* rx_time in microseconds */
+	uint64_t seq;                       /* push order (for stable ordering) */
+	int stream;
+	la_msg_dir msg_dir;
+	int len;
+	uint8_t buf[];
+} la_acars_merge_frame;
+
+typedef struct {
+	int64_t last_usec;                  /* latest rx_time seen in this stream */
+	bool started;                       /* at least one frame has been pushed */
+	bool ended;                         /* la_acars_merge_stream_end() has been called */
+} la_acars_merge_stream;
+
+struct la_acars_merge_s {
+	la_reasm_ctx *rtables;
+	la_acars_merge_output_func *output_cb;
+	void *output_cb_ctx;
+	int64_t reorder_window_usec;
+	size_t max_frames;                  /* 0 - no limit */
+	la_acars_merge_stream *streams;
+	int stream_cnt;
+	la_acars_merge_frame **heap;        /* binary min-heap of buffered frames */
+	size_t heap_len;
+	size_t heap_size;
+	uint64_t seq;
+	int64_t max_seen_usec;              /* latest rx_time seen in any stream */
+	int64_t last_released_usec;         /* rx_time of the last released frame */
+	bool released_any;
+	la_acars_merge_stats stats;
+};
+
+static int64_t la_acars_merge_timeval_usec(struct timeval tv) {
+	return (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+static bool la_acars_merge_frame_before(la_acars_merge_frame const *f1,
+		la_acars_merge_frame const *f2) {
+	return f1->rx_usec < f2->rx_usec || (f1->rx_usec == f2->rx_usec && f1->seq < f2->seq);
+}
+
+/********************************************************************************
+ * Frame heap
+ ********************************************************************************/
+
+static void la_acars_merge_heap_push(la_acars_merge *merge, la_acars_merge_frame *frame) {
+	if(merge->heap_len == merge->heap_size) {
+		merge->heap_size = merge->heap_size > 0 ? 2 * merge->heap_size : 64;
+		merge->heap = LA_HEAP_XREALLOC(merge->heap, merge->heap_size * sizeof(la_acars_merge_frame *));
+	}
+	size_t idx = merge->heap_len++;
+	while(idx > 0) {
+		size_t parent = (idx - 1) / 2;
+		if(!la_acars_merge_frame_before(frame, merge->heap[parent])) {
+			break;
+		}
+		merge->heap[idx] = merge->heap[parent];
+		idx = parent;
+	}
+	merge->heap[idx] = frame;
+}
+
+static la_acars_merge_frame *la_acars_merge_heap_pop(la_acars_merge *merge) {
+	la_assert(merge->heap_len > 0);
+	la_acars_merge_frame *result = merge->heap[0];
+	la_acars_merge_frame *last = merge->heap[--merge->heap_len];
+	size_t len = merge->heap_len;
+	size_t idx = 0;
+	for(;;) {
+		size_t child = 2 * idx + 1;
+		if(child >= len) {
+			break;
+		}
+		if(child + 1 < len && la_acars_merge_frame_before(merge->heap[child + 1], merge->heap[child])) {
+			child++;
+		}
+		if(!la_acars_merge_frame_before(merge->heap[child], last)) {
+			break;
+		}
+		merge->heap[idx] = merge->heap[child];
+		idx = child;
+	}
+	if(len > 0) {
+		merge->heap[idx] = last;
+	}
+	return result;
+}
+
+/********************************************************************************
+ * Merging
+ ********************************************************************************/
+
+static void la_acars_merge_release_one(la_acars_merge *merge) {
+	la_acars_merge_frame *frame = la_acars_merge_heap_pop(merge);
+	struct timeval rx_time = {
+		.tv_sec = frame->rx_usec / 1000000,
+		.tv_usec = frame->rx_usec % 1000000
+	};
+	la_proto_node *node = la_acars_parse_and_reassemble(frame->buf, frame->len,
+			frame->msg_dir, merge->rtables, rx_time);
+	merge->last_released_usec = frame->rx_usec;
+	merge->released_any = true;
+	merge->stats.frames_out++;
+	merge->output_cb(node, frame->stream, rx_time, merge->output_cb_ctx);
+	LA_XFREE(frame);
+}
+
+// Returns the rx_time up to which all frames may be released
+static int64_t la_acars_merge_threshold(la_acars_merge const *merge) {
+	int64_t watermark = INT64_MAX;
+	for(int i = 0; i < merge->stream_cnt; i++) {
+		la_acars_merge_stream const *s = merge->streams + i;
+		if(s->ended) {
+			continue;
+		}
+		watermark = s->started ? LA_MIN(watermark, s->last_usec) : INT64_MIN;
+	}
+	return LA_MAX(watermark, merge->max_seen_usec - merge->reorder_window_usec);
+}
+
+static void la_acars_merge_release(la_acars_merge *merge) {
+	int64_t threshold = la_acars_merge_threshold(merge);
+	while(merge->heap_len > 0 && merge->heap[0]->rx_usec <= threshold) {
+		la_acars_merge_release_one(merge);
+	}
+	while(merge->max_frames > 0 && merge->heap_len > merge->max_frames) {
+		merge->stats.frames_forced++;
+		la_acars_merge_release_one(merge);
+	}
+}
+
+// Creates a new merge buffer for stream_cnt streams. Decoded frames are
+// reassembled in rtables (which may be NULL, if reassembly is not needed)
+// and passed to output_cb. max_frames limits the number of buffered frames
+// (0 means no limit).
+la_acars_merge *la_acars_merge_new(la_reasm_ctx *rtables, int stream_cnt,
+		struct timeval reorder_window, size_t max_frames,
+		la_acars_merge_output_func *output_cb, void *output_cb_ctx) {
+	la_assert(stream_cnt > 0);
+	la_assert(reorder_window.tv_sec >= 0 && reorder_window.tv_usec >= 0);
+	la_assert(output_cb != NULL);
+
+	LA_HEAP_NEW(la_acars_merge, merge);
+	merge->rtables = rtables;
+	merge->output_cb = output_cb;
+	merge->output_cb_ctx = output_cb_ctx;
+	merge->reorder_window_usec = la_acars_merge_timeval_usec(reorder_window);
+	merge->max_frames = max_frames;
+	merge->stream_cnt = stream_cnt;
+	merge->streams = LA_HEAP_XCALLOC(stream_cnt, sizeof(la_acars_merge_stream));
+	merge->max_seen_usec = INT64_MIN + merge->reorder_window_usec;
+	return merge;
+}
+
+// Adds a frame received in the given stream. The frame is copied, so buf
+// may be reused by the caller. Frames which can be released as a result are
+// passed to the output callback before this function returns.
+void la_acars_merge_push(la_acars_merge *merge, int stream, uint8_t const *buf, int len,
+		la_msg_dir msg_dir, struct timeval rx_time) {
+	la_assert(merge != NULL);
+	la_assert(stream >= 0 && stream < merge->stream_cnt);
+	la_assert(buf != NULL || len == 0);
+
+	len = LA_MAX(len, 0);
+	la_acars_merge_frame *frame = LA_HEAP_XCALLOC(1, sizeof(la_acars_merge_frame) + len);
+	frame->rx_usec = la_acars_merge_timeval_usec(rx_time);
+	frame->seq = merge->seq++;
+	frame->stream = stream;
+	frame->msg_dir = msg_dir;
+	frame->len = len;
+	if(len > 0) {
+		memcpy(frame->buf, buf, len);
+	}
+	merge->stats.frames_in++;
+	if(merge->released_any && frame->rx_usec < merge->last_released_usec) {
+		la_debug_print(D_INFO, "stream %d: late frame (%lld < %lld)\n", stream,
+				(long long)frame->rx_usec, (long long)merge->last_released_usec);
+		merge->stats.frames_late++;
+	}
+
+	la_acars_merge_stream *s = merge->streams + stream;
+	s->last_usec = s->started ? LA_MAX(s->last_usec, frame->rx_usec) : frame->rx_usec;
+	s->started = true;
+	s->ended = false;
+	merge->max_seen_usec = LA_MAX(merge->max_seen_usec, frame->rx_usec);
+
+	la_acars_merge_heap_push(merge, frame);
+	la_acars_merge_release(merge);
+}
+
+// Marks the end of the given stream, so that it no longer holds back
+// frames of other streams. Pushing a frame into this stream reopens it.
+void la_acars_merge_stream_end(la_acars_merge *merge, int stream) {
+	la_assert(merge != NULL);
+	la_assert(stream >= 0 && stream < merge->stream_cnt);
+
+	merge->streams[stream].ended = true;
+	la_acars_merge_release(merge);
+}
+
+// Releases all buffered frames.
+void la_acars_merge_flush(la_acars_merge *merge) {
+	la_assert(merge != NULL);
+
+	while(merge->heap_len > 0) {
+		la_acars_merge_release_one(merge);
+	}
+}
+
+void la_acars_merge_stats_get(la_acars_merge const *merge, la_acars_merge_stats *result) {
+	la_assert(merge != NULL);
+	la_assert(result != NULL);
+
+	*result = merge->stats;
+	result->frames_buffered = merge->heap_len;
+}
+
+// Frees the merge buffer. Buffered frames are discarded without decoding
+// (call la_acars_merge_flush() first to avoid this).
+void la_acars_merge_destroy(la_acars_merge *merge) {
+	if(merge == NULL) {
+		return;
+	}
+	for(size_t i = 0; i < merge->heap_len; i++) {
+		LA_XFREE(merge->heap[i]);
+	}
+	LA_XFREE(merge->heap);
+	LA_XFREE(merge->streams);
+	LA_XFREE(merge);
+}
@@ -0,0 +1,60 @@
+/*
+ *  This file is a part of libacars
+ *
+ *  Copyright (c) 2018-2023 Tomasz Lemiech <szpajder@gmail.com>
+ */
+
+#ifndef LA_ACARS_MERGE_H
+#define LA_ACARS_MERGE_H 1
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <libacars/libacars.h>              // la_proto_node, la_msg_dir
+#include <libacars/reassembly.h>            // la_reasm_ctx, struct timeval
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct la_acars_merge_s la_acars_merge;
+
+// Called for every frame released from the merge buffer, in rx_time order.
+// node is the result of la_acars_parse_and_reassemble() (possibly NULL) and
+// the callee becomes its owner.
+typedef void (la_acars_merge_output_func)(la_proto_node *node, int stream,
+		struct timeval rx_time, void *ctx);
+
+typedef struct {
+	uint64_t frames_in;             /* frames pushed */
+
+	uint64_t frames_out;            /* frames released */
+
+	uint64_t frames_late;           /* frames which arrived after a frame with
+	                                   a later rx_time had been released already */
+
+	uint64_t frames_forced;         /* frames released early, because the buffer
+	                                   has been full */
+
+	size_t frames_buffered;         /* frames currently held in the buffer */
+// reserved for future use
+	void (*reserved0)(void);
+	void (*reserved1)(void);
+	void (*reserved2)(void);
+	void (*reserved3)(void);
+} la_acars_merge_stats;
+
+// acars-merge.c
+la_acars_merge *la_acars_merge_new(la_reasm_ctx *rtables, int stream_cnt,
+		struct timeval reorder_window, size_t max_frames,
+		la_acars_merge_output_func *output_cb, void *output_cb_ctx);
+void la_acars_merge_push(la_acars_merge *merge, int stream, uint8_t const *buf, int len,
+		la_msg_dir msg_dir, struct timeval rx_time);
+void la_acars_merge_stream_end(la_acars_merge *merge, int stream);
+void la_acars_merge_flush(la_acars_merge *merge);
+void la_acars_merge_stats_get(la_acars_merge const *merge, la_acars_merge_stats *result);
+void la_acars_merge_destroy(la_acars_merge *merge);
+
+#ifdef __cplusplus
+}
+#endif
+#endif // !LA_ACARS_MERGE_H
@@ -4,7 +4,7 @@
  *  Copyright (c) 2018-2023 Tomasz Lemiech <szpajder@gmail.com>
  */
 
-#include <string.h>                         // memcpy(), strdup()
+#include <string.h>                         // memcpy()
 #include "config.h"                         // WITH_LIBXML2, HAVE_SYS_TIME_H
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>                       // struct timeval
@@ -12,17 +12,17 @@
 #ifdef WITH_LIBXML2
 #include <libxml/tree.h>                    // xmlBufferPtr, xmlBufferFree()
 #endif
-#include <libacars/libacars.h>              // la_proto_node, la_proto_tree_find_protocol
+#include <libacars/libacars.h>              // la_proto_node, la_proto_tree_find_protocol, la_decoder_config_*
 #include <libacars/macros.h>                // la_assert, la_debug_print
 #include <libacars/arinc.h>                 // la_arinc_parse()
 #include <libacars/media-adv.h>             // la_media_adv_parse()
 #include <libacars/miam.h>                  // la_miam_parse_and_reassemble()
 #include <libacars/ohma.h>                  // la_ohma_parse_and_reassemble()
 #include <libacars/crc.h>                   // la_crc16_ccitt()
+#include <libacars/parity.h>                // la_parity_strip(), la_parity_error_count()
 #include <libacars/vstring.h>               // la_vstring, LA_ISPRINTF()
 #include <libacars/json.h>                  // la_json_append_*()
-#include <libacars/util.h>                  // LA_XCALLOC, LA_XFREE, la_prettify_xml
-#include <libacars/hash.h>                  // LA_HASH_INIT, la_hash_string()
+#include <libacars/util.h>                  // LA_XCALLOC, LA_XSTRDUP, LA_HEAP_NEW, LA_XFREE, la_prettify_xml, la_hash_words()
 #include <libacars/reassembly.h>
 #include <libacars/acars.h>
 
@@ -66,24 +66,33 @@ static la_acars_timeout_profile const timeout_profiles[] = {
 	}
 };
 
-typedef struct {
-	char *reg, *label, *msg_num;
+// Reassembly key. Fields are zero-padded copies of the message header fields,
+// so that the key can be hashed and compared as two 64-bit words.
+typedef union {
+	struct {
+		char reg[7];
+		char label[2];
+		char msg_num[3];
+	} f;
+	uint64_t w[2];
 } la_acars_key;
 
+static void la_acars_key_fill(la_acars_key *key, la_acars_msg const *msg) {
+	key->w[0] = key->w[1] = 0;
+	la_strpad(key->f.reg, msg->reg, sizeof(key->f.reg));
+	la_strpad(key->f.label, msg->label, sizeof(key->f.label));
+	la_strpad(key->f.msg_num, msg->msg_num, sizeof(key->f.msg_num));
+}
+
 static uint32_t la_acars_key_hash(void const *key) {
-	la_acars_key *k = (la_acars_key *)key;
-	uint32_t h = la_hash_string(k->reg, LA_HASH_INIT);
-	h = la_hash_string(k->label, h);
-	h = la_hash_string(k->msg_num, h);
-	return h;
+	la_acars_key const *k = key;
+	return la_hash_words(k->w, 2);
 }
 
 static bool la_acars_key_compare(void const *key1, void const *key2) {
 	la_acars_key const *k1 = key1;
 	la_acars_key const *k2 = key2;
-	return (!strcmp(k1->reg, k2->reg) &&
-			!strcmp(k1->label, k2->label) &&
-			!strcmp(k1->msg_num, k2->msg_num));
+	return k1->w[0] == k2->w[0] && k1->w[1] == k2->w[1];
 }
 
 static void la_acars_key_destroy(void *ptr) {
@@ -91,42 +100,50 @@ static void la_acars_key_destroy(void *ptr) {
 		return;
 	}
 	la_acars_key *key = ptr;
-	la_debug_print(D_INFO, "DESTROY KEY %s %s %s\n", key->reg, key->label, key->msg_num);
-	LA_XFREE(key->reg);
-	LA_XFREE(key->label);
-	LA_XFREE(key->msg_num);
+	la_debug_print(D_INFO, "DESTROY KEY %.7s %.2s %.3s\n", key->f.reg, key->f.label, key->f.msg_num);
 	LA_XFREE(key);
 }
 
-static void *la_acars_tmp_key_get(void const *msg) {
+static void *la_acars_key_get(void const *msg) {
 	la_assert(msg != NULL);
-	la_acars_msg const *amsg = msg;
-	LA_NEW(la_acars_key, key);
-	key->reg = (char *)amsg->reg;
-	key->label = (char *)amsg->label;
-	key->msg_num = (char *)amsg->msg_num;
+	LA_HEAP_NEW(la_acars_key, key);
+	la_acars_key_fill(key, msg);
+	la_debug_print(D_INFO, "ALLOC KEY %.7s %.2s %.3s\n", key->f.reg, key->f.label, key->f.msg_num);
 	return (void *)key;
 }
 
-static void *la_acars_key_get(void const *msg) {
-	la_assert(msg != NULL);
-	la_acars_msg const *amsg = msg;
-	LA_NEW(la_acars_key, key);
-	key->reg = strdup(amsg->reg);
-	key->label = strdup(amsg->label);
-	key->msg_num = strdup(amsg->msg_num);
-	la_debug_print(D_INFO, "ALLOC KEY %s %s %s\n", key->reg, key->label, key->msg_num);
+static size_t la_acars_key_serialize(void const *key, uint8_t *buf, size_t buflen) {
+	la_acars_key const *k = key;
+	if(buflen >= sizeof(k->f)) {
+		memcpy(buf, &k->f, sizeof(k->f));
+	}
+	return sizeof(k->f);
+}
+
+static void *la_acars_key_deserialize(uint8_t const *buf, size_t len) {
+	LA_HEAP_NEW(la_acars_key, key);
+	if(len != sizeof(key->f)) {
+		LA_XFREE(key);
+		return NULL;
+	}
+	memcpy(&key->f, buf, len);
 	return (void *)key;
 }
 
 static la_reasm_table_funcs acars_reasm_funcs = {
 	.get_key = la_acars_key_get,
-	.get_tmp_key = la_acars_tmp_key_get,
+	.get_tmp_key = la_acars_key_get,
 	.hash_key = la_acars_key_hash,
 	.compare_keys = la_acars_key_compare,
 	.destroy_key = la_acars_key_destroy
 };
 
+static la_reasm_key_codec const acars_reasm_key_codec = {
+	.name = "acars",
+	.serialize_key = la_acars_key_serialize,
+	.deserialize_key = la_acars_key_deserialize
+};
+
 la_proto_node *la_acars_apps_parse_and_reassemble(char const *reg,
 		char const *label, char const *txt, la_msg_dir msg_dir,
 		la_reasm_ctx *rtables, struct timeval rx_time) {
@@ -267,19 +284,67 @@ end:
 	return consumed;
 }
 
-// Note: buf must contain raw ACARS bytes, NOT including initial SOH byte
-// (0x01) and including terminating DEL byte (0x7f).
-la_proto_node *la_acars_parse_and_reassemble(uint8_t const* buf, int len, la_msg_dir msg_dir,
-		la_reasm_ctx *rtables, struct timeval rx_time) {
-	if(buf == NULL) {
-		return NULL;
+// Maximum length of downlink-specific fields, sublabel and MFI
+// at the beginning of the message text
+#define LA_ACARS_TEXT_HDR_MAX_LEN (10 + 5 + 4)
+
+// Returns a buffer for len characters of message text plus the terminating
+// NULL - either the caller's scratch buffer (if it's large enough) or
+// a newly allocated one.
+static char *la_acars_text_buf_get(la_acars_msg *msg, char *scratch, size_t scratch_len, int len) {
+	if(scratch != NULL && scratch_len > (size_t)len) {
+		msg->txt_in_scratch = true;
+		return scratch;
 	}
+	return LA_XCALLOC(len + 1, sizeof(char));
+}
 
+// Decoder state which does not depend on the frame being decoded.
+// It's set up once per call or once per batch (see la_acars_parse_batch()).
+typedef struct {
+	la_reasm_ctx *rtables;                      /* NULL if reassembly is disabled */
+	la_reasm_table *rtable;                     /* ACARS reassembly table, looked up on first use */
+	la_decoder_config const *config;
+	long int acars_bearer;
+	la_acars_timeout_profile const *timeout_profile;
+} la_acars_parse_ctx;
+
+static void la_acars_parse_ctx_init(la_acars_parse_ctx *ctx, la_reasm_ctx *rtables) {
+	ctx->rtables = rtables;
+	ctx->rtable = NULL;
+	ctx->config = la_decoder_config_get();
+	ctx->acars_bearer = ctx->config->acars_bearer;
+	if(ctx->acars_bearer < LA_ACARS_BEARER_MIN || ctx->acars_bearer > LA_ACARS_BEARER_MAX) {
+		// This bearer will cause reassembly to fail with LA_REASM_INVALID_ARGS
+		ctx->acars_bearer = LA_ACARS_BEARER_INVALID;
+	}
+	ctx->timeout_profile = timeout_profiles + ctx->acars_bearer;
+}
+
+static la_reasm_table *la_acars_parse_ctx_rtable_get(la_acars_parse_ctx *ctx) {
+	if(ctx->rtable == NULL) {
+		ctx->rtable = la_reasm_table_lookup(ctx->rtables, &la_DEF_acars_message);
+		if(ctx->rtable == NULL) {
+			ctx->rtable = la_reasm_table_new(ctx->rtables, &la_DEF_acars_message,
+					acars_reasm_funcs, LA_ACARS_REASM_TABLE_CLEANUP_INTERVAL);
+			la_reasm_table_key_codec_set(ctx->rtable, &acars_reasm_key_codec);
+		}
+	}
+	return ctx->rtable;
+}
+
+// Note: buf must contain raw ACARS bytes, NOT including initial SOH byte
+// (0x01) and including terminating DEL byte (0x7f).
+// If crc is not NULL, it points to the CRC of the frame computed in advance
+// (see la_acars_frame_crc_len()).
+static la_proto_node *la_acars_parse_internal(la_acars_parse_ctx *ctx, uint8_t const *buf,
+		int len, la_msg_dir msg_dir, struct timeval rx_time, char *scratch, size_t scratch_len,
+		uint16_t const *crc) {
+	LA_ALLOC_MODULE_ENTER(LA_ALLOC_MODULE_ACARS);
 	la_proto_node *node = la_proto_node_new();
 	LA_NEW(la_acars_msg, msg);
 	node->data = msg;
 	node->td = &la_DEF_acars_message;
-	char *buf2 = LA_XCALLOC(len, sizeof(char));
 
 	msg->err = false;
 	if(len < LA_ACARS_PREAMBLE_LEN) {
@@ -293,24 +358,25 @@ la_proto_node *la_acars_parse_and_reassemble(uint8_t const* buf, int len, la_msg
 	}
 	len--;
 
-	uint16_t crc = la_crc16_ccitt(buf, len, 0);
-	la_debug_print(D_INFO, "CRC check result: %04x\n", crc);
+	uint16_t crc_result = crc != NULL ? *crc : la_crc16_ccitt(buf, len, 0);
+	la_debug_print(D_INFO, "CRC check result: %04x\n", crc_result);
 	len -= 2;
-	msg->crc_ok = (crc == 0);
+	msg->crc_ok = (crc_result == 0);
 
-	int i = 0;
-	for(i = 0; i < len; i++) {
-		buf2[i] = buf[i] & 0x7f;
-	}
-	la_debug_print_buf_hex(D_VERBOSE, buf2, len, "After CRC and parity bit removal:\n");
+	la_debug_print_buf_hex(D_VERBOSE, buf, len, "After CRC removal:\n");
 	la_debug_print(D_INFO, "Length: %d\n", len);
 
-	if(buf2[len-1] == ETX) {
+	// Parity bits are stripped on the fly. Header fields are copied into msg
+	// and the text is copied only once - directly into its final location.
+	// Parity is verified for all characters up to ETX/ETB.
+	int char_cnt = len;
+	uint8_t end_byte = buf[len-1] & 0x7f;
+	if(end_byte == ETX) {
 		msg->final_block = true;
-	} else if(buf2[len-1] == ETB) {
+	} else if(end_byte == ETB) {
 		msg->final_block = false;
 	} else {
-		la_debug_print(D_ERROR, "%02x: no ETX/ETB byte at end of text\n", buf2[len-1]);
+		la_debug_print(D_ERROR, "%02x: no ETX/ETB byte at end of text\n", end_byte);
 		goto fail;
 	}
 	len--;
@@ -318,16 +384,18 @@ la_proto_node *la_acars_parse_and_reassemble(uint8_t const* buf, int len, la_msg
 	// There are at least 12 bytes remaining.
 
 	int remaining = len;
-	char *ptr = buf2;
+	uint8_t const *ptr = buf;
 
-	msg->mode = *ptr;
+	msg->mode = *ptr & 0x7f;
 	ptr++; remaining--;
 
-	memcpy(msg->reg, ptr, 7);
+	for(int i = 0; i < 7; i++) {
+		msg->reg[i] = ptr[i] & 0x7f;
+	}
 	msg->reg[7] = '\0';
 	ptr += 7; remaining -= 7;
 
-	msg->ack = *ptr;
+	msg->ack = *ptr & 0x7f;
 	ptr++; remaining--;
 
 	// change special values to something printable
@@ -337,8 +405,8 @@ la_proto_node *la_acars_parse_and_reassemble(uint8_t const* buf, int len, la_msg
 		msg->ack = '^';
 	}
 
-	msg->label[0] = *ptr++;
-	msg->label[1] = *ptr++;
+	msg->label[0] = *ptr++ & 0x7f;
+	msg->label[1] = *ptr++ & 0x7f;
 	remaining -= 2;
 
 	if (msg->label[1] == 0x7f) {
@@ -346,7 +414,7 @@ la_proto_node *la_acars_parse_and_reassemble(uint8_t const* buf, int len, la_msg
 	}
 	msg->label[2] = '\0';
 
-	msg->block_id = *ptr;
+	msg->block_id = *ptr & 0x7f;
 	ptr++; remaining--;
 
 	if (msg->block_id == 0) {
@@ -369,7 +437,9 @@ la_proto_node *la_acars_parse_and_reassemble(uint8_t const* buf, int len, la_msg
 		// empty ACKs (label: _<7F> aka _d), because they have out-of-sequence
 		// block IDs (X, Y, Z, X, ...).
 		if(!IS_DOWNLINK_BLK(msg->block_id)) {
-			msg->txt = strdup("");
+			msg->parity_errors = la_parity_error_count(buf, char_cnt);
+			msg->txt = la_acars_text_buf_get(msg, scratch, scratch_len, 0);
+			msg->txt[0] = '\0';
 			msg->reasm_status = LA_REASM_SKIPPED;
 			goto end;
 		} else {
@@ -378,110 +448,242 @@ la_proto_node *la_acars_parse_and_reassemble(uint8_t const* buf, int len, la_msg
 		}
 	}
 	// Otherwise we expect STX here.
-	if(*ptr != STX) {
-		la_debug_print(D_ERROR, "%02x: No STX byte after preamble\n", *ptr);
+	if((*ptr & 0x7f) != STX) {
+		la_debug_print(D_ERROR, "%02x: No STX byte after preamble\n", *ptr & 0x7f);
 		goto fail;
 	}
 	ptr++; remaining--;
 
-	// Replace NULLs in message text to make it printable
+	// Fields preceding the application payload are located using
+	// a copy of the beginning of the text.
+	char hdr[LA_ACARS_TEXT_HDR_MAX_LEN];
+	int hdr_len = LA_MIN(remaining, LA_ACARS_TEXT_HDR_MAX_LEN);
 	// XXX: Should we replace all nonprintable chars here?
-	for(i = 0; i < remaining; i++) {
-		if(ptr[i] == 0) {
-			ptr[i] = '.';
-		}
-	}
+	(void)la_parity_strip(hdr, ptr, hdr_len);
+	int offset = 0;
+
 	// Extract downlink-specific fields from message text
 	if (IS_DOWNLINK_BLK(msg->block_id)) {
 		if(remaining < 10) {
 			la_debug_print(D_ERROR, "Downlink text field too short: %d < 10\n", remaining);
 			goto fail;
 		}
-		memcpy(msg->msg_num, ptr, 3);
+		memcpy(msg->msg_num, hdr, 3);
 		msg->msg_num[3] = '\0';
-		msg->msg_num_seq = ptr[3];
-		ptr += 4; remaining -= 4;
-		memcpy(msg->flight_id, ptr, 6);
-		ptr += 6; remaining -= 6;
+		msg->msg_num_seq = hdr[3];
+		memcpy(msg->flight_id, hdr + 4, 6);
+		offset = 10;
 	}
 
 	// Extract sublabel and MFI if present
-	int offset = la_acars_extract_sublabel_and_mfi(msg->label, msg_dir,
-			ptr, remaining, msg->sublabel, msg->mfi);
-	if(offset > 0) {
-		ptr += offset;
-		remaining -= offset;
-	}
-
-	la_reasm_table *acars_rtable = NULL;
-	if(rtables != NULL) {       // reassembly engine is enabled
-		acars_rtable = la_reasm_table_lookup(rtables, &la_DEF_acars_message);
-		if(acars_rtable == NULL) {
-			acars_rtable = la_reasm_table_new(rtables, &la_DEF_acars_message,
-					acars_reasm_funcs, LA_ACARS_REASM_TABLE_CLEANUP_INTERVAL);
-		}
+	int sublabel_len = la_acars_extract_sublabel_and_mfi(msg->label, msg_dir,
+			hdr + offset, hdr_len - offset, msg->sublabel, msg->mfi);
+	if(sublabel_len > 0) {
+		offset += sublabel_len;
+	}
+	ptr += offset; remaining -= offset;
+
+	char *txt = la_acars_text_buf_get(msg, scratch, scratch_len, remaining);
+	msg->parity_errors = la_parity_error_count(buf, ptr - buf) +     // preamble up to the text
+		la_parity_error_count(buf + char_cnt - 1, 1) +                // ETX/ETB
+		la_parity_strip(txt, ptr, remaining);
+	txt[remaining] = '\0';
+
+	uint8_t *reassembled_msg = NULL;
+	int reasm_len = -1;
+	if(ctx->rtables != NULL) {  // reassembly engine is enabled
+		la_reasm_table *acars_rtable = la_acars_parse_ctx_rtable_get(ctx);
 		bool down = IS_DOWNLINK_BLK(msg->block_id);
 
-		long int acars_bearer = LA_ACARS_BEARER_INVALID;
-		(void)la_config_get_int("acars_bearer", &acars_bearer);
-		if(acars_bearer < LA_ACARS_BEARER_MIN || acars_bearer > LA_ACARS_BEARER_MAX) {
-			// This bearer will cause reassembly to fail with LA_REASM_INVALID_ARGS
-			acars_bearer = LA_ACARS_BEARER_INVALID;
-		}
-		la_acars_timeout_profile const *timeout_profile = timeout_profiles + acars_bearer;
+		long int acars_bearer = ctx->acars_bearer;
+		la_acars_timeout_profile const *timeout_profile = ctx->timeout_profile;
 		la_debug_print(D_VERBOSE, "Using timeout profile for bearer %ld (up: %lu dn: %lu)\n",
 				acars_bearer,
 				timeout_profile->uplink.tv_sec,
 				timeout_profile->downlink.tv_sec);
 
-		msg->reasm_status = la_reasm_fragment_add(acars_rtable,
-				&(la_reasm_fragment_info){
-				.msg_info = msg,
-				.msg_data = (uint8_t *)ptr,
-				.msg_data_len = remaining,
-				.total_pdu_len = 0,         // not used here
-				.total_fragment_cnt = 0,    // not used here
-				.seq_num = down ? msg->msg_num_seq - 'A' : msg->block_id - 'A',
-				.seq_num_first = down ? 0 : SEQ_FIRST_NONE,
-				.seq_num_wrap = down ? SEQ_WRAP_NONE : 'X' - 'A',
-				.is_final_fragment = msg->final_block,
-				.rx_time = rx_time,
-				.reasm_timeout = down ? timeout_profile->downlink : timeout_profile->uplink
-				});
+		la_acars_key tmp_key;
+		la_acars_key_fill(&tmp_key, msg);
+		la_reasm_fragment_info finfo = {
+			.msg_info = msg,
+			.tmp_key = &tmp_key,
+			.msg_data = (uint8_t *)txt,
+			.msg_data_len = remaining,
+			.total_pdu_len = 0,         // not used here
+			.total_fragment_cnt = 0,    // not used here
+			.seq_num = down ? msg->msg_num_seq - 'A' : msg->block_id - 'A',
+			.seq_num_first = down ? 0 : SEQ_FIRST_NONE,
+			.seq_num_wrap = down ? SEQ_WRAP_NONE : 'X' - 'A',
+			.is_final_fragment = msg->final_block,
+			.rx_time = rx_time,
+			.reasm_timeout = down ? timeout_profile->downlink : timeout_profile->uplink
+		};
+		// key_hash and timeout_class share storage, so the hash is computed
+		// by the engine when adaptive timeouts are enabled.
+		if(ctx->config->acars_adaptive_timeouts) {
+			finfo.flags = LA_REASM_ADAPTIVE_TIMEOUT;
+			// Bearer, direction and label determine the timing of block transmissions
+			finfo.timeout_class = (uint32_t)acars_bearer << 24 | (uint32_t)down << 16 |
+				(uint32_t)(uint8_t)msg->label[0] << 8 | (uint32_t)(uint8_t)msg->label[1];
+		} else {
+			finfo.flags = LA_REASM_KEY_HASH_SET;
+			finfo.key_hash = la_acars_key_hash(&tmp_key);
+		}
+		msg->reasm_status = la_reasm_fragment_add_and_reassemble(acars_rtable,
+				&finfo, &reassembled_msg, &reasm_len);
 	}
-	uint8_t *reassembled_msg = NULL;
-	if(msg->reasm_status == LA_REASM_COMPLETE &&
-			la_reasm_payload_get(acars_rtable, msg, &reassembled_msg) > 0) {
+	int txt_len = remaining;
+	if(reasm_len > 0) {
 		// reassembled_msg is a newly allocated byte buffer, which is guaranteed to
 		// be NULL-terminated, so we can cast it to char * directly.
+		if(msg->txt_in_scratch) {
+			msg->txt_in_scratch = false;
+		} else {
+			LA_XFREE(txt);
+		}
 		msg->txt = (char *)reassembled_msg;
-
+		txt_len = reasm_len;
 	} else {        // this will also trigger when reassembly engine is disabled
-		msg->txt = LA_XCALLOC(remaining + 1, sizeof(char));
-		if(remaining > 0) {
-			memcpy(msg->txt, ptr, remaining);
-		}
+		msg->txt = txt;
 	}
 
-	if(strlen(msg->txt) > 0) {
+	if(txt_len > 0) {
 		bool decode_apps = true;
 		// If reassembly is enabled and is now in progress (ie. the message is not yet complete),
 		// then decode_fragments config flag decides whether to decode apps in this message
 		// or not.
-		if(rtables != NULL && (msg->reasm_status == LA_REASM_IN_PROGRESS ||
+		if(ctx->rtables != NULL && (msg->reasm_status == LA_REASM_IN_PROGRESS ||
 					msg->reasm_status == LA_REASM_DUPLICATE)) {
-			(void)la_config_get_bool("decode_fragments", &decode_apps);
+			decode_apps = ctx->config->decode_fragments;
 		}
 		if(decode_apps) {
 			node->next = la_acars_apps_parse_and_reassemble(msg->reg, msg->label,
-					msg->txt, msg_dir, rtables, rx_time);
+					msg->txt, msg_dir, ctx->rtables, rx_time);
 		}
 	}
 	goto end;
 fail:
 	msg->err = true;
 end:
-	LA_XFREE(buf2);
+	LA_ALLOC_MODULE_LEAVE();
+	return node;
+}
+
+la_proto_node *la_acars_parse_and_reassemble(uint8_t const *buf, int len, la_msg_dir msg_dir,
+		la_reasm_ctx *rtables, struct timeval rx_time) {
+	if(buf == NULL) {
+		return NULL;
+	}
+	la_acars_parse_ctx ctx;
+	la_acars_parse_ctx_init(&ctx, rtables);
+	return la_acars_parse_internal(&ctx, buf, len, msg_dir, rx_time, NULL, 0, NULL);
+}
+
+// Same as la_acars_parse_and_reassemble(), but the message text is stored
+// in the scratch buffer supplied by the caller instead of a newly allocated
+// one (unless it's a reassembled message or the buffer is too small).
+// The buffer must hold at least len bytes and it must not be modified
+// or freed while the resulting tree is in use.
+la_proto_node *la_acars_parse_and_reassemble_with_scratch(uint8_t const *buf, int len,
+		la_msg_dir msg_dir, la_reasm_ctx *rtables, struct timeval rx_time,
+		char *scratch, size_t scratch_len) {
+	if(buf == NULL) {
+		return NULL;
+	}
+	la_acars_parse_ctx ctx;
+	la_acars_parse_ctx_init(&ctx, rtables);
+	return la_acars_parse_internal(&ctx, buf, len, msg_dir, rx_time, scratch, scratch_len, NULL);
+}
+
+// Returns the number of bytes of the frame covered by the CRC
+// or 0 if the frame is too short or malformed to be decoded.
+static uint32_t la_acars_frame_crc_len(la_acars_frame const *frame) {
+	if(frame->buf == NULL || frame->len < LA_ACARS_PREAMBLE_LEN || frame->buf[frame->len-1] != DEL) {
+		return 0;
+	}
+	return frame->len - 1;
+}
+
+// Number of frames processed in one step of la_acars_parse_batch()
+#define LA_ACARS_BATCH_CHUNK 16
+
+// Decodes n frames received in a burst and stores the resulting protocol
+// trees in results[0..n-1], in input order. Frames are processed in input
+// order, so they must be sorted by reception time when reassembly is
+// enabled. rx_times may be NULL if rtables is NULL.
+// Decoder settings and the reassembly table are looked up once for the whole
+// batch. Frames are processed in small chunks - CRCs of all frames in the
+// chunk are computed in an interleaved manner first, then the frames are
+// decoded while they are still in the cache.
+// Returns the number of frames decoded without errors.
+size_t la_acars_parse_batch(la_acars_frame const *frames, size_t n,
+		struct timeval const *rx_times, la_reasm_ctx *rtables, la_proto_node **results) {
+	if(frames == NULL || results == NULL) {
+		return 0;
+	}
+	la_assert(rtables == NULL || rx_times != NULL);
+	la_acars_parse_ctx ctx;
+	la_acars_parse_ctx_init(&ctx, rtables);
+	size_t ok_cnt = 0;
+	for(size_t start = 0; start < n; start += LA_ACARS_BATCH_CHUNK) {
+		size_t cnt = LA_MIN(n - start, LA_ACARS_BATCH_CHUNK);
+		uint8_t const *crc_data[LA_ACARS_BATCH_CHUNK];
+		uint32_t crc_len[LA_ACARS_BATCH_CHUNK];
+		uint16_t crc[LA_ACARS_BATCH_CHUNK];
+		size_t crc_cnt = 0;
+		for(size_t i = 0; i < cnt; i++) {
+			uint32_t len = la_acars_frame_crc_len(frames + start + i);
+			if(len > 0) {
+				crc_data[crc_cnt] = frames[start+i].buf;
+				crc_len[crc_cnt++] = len;
+			}
+		}
+		la_crc16_ccitt_multi(crc_data, crc_len, crc_cnt, 0, crc);
+
+		uint16_t const *next_crc = crc;
+		for(size_t i = start; i < start + cnt; i++) {
+			if(frames[i].buf == NULL) {
+				results[i] = NULL;
+				continue;
+			}
+			struct timeval rx_time = rx_times != NULL ? rx_times[i] :
+				(struct timeval){ .tv_sec = 0, .tv_usec = 0 };
+			// Malformed frames are rejected before the CRC is needed
+			uint16_t const *frame_crc = la_acars_frame_crc_len(frames + i) > 0 ? next_crc++ : NULL;
+			results[i] = la_acars_parse_internal(&ctx, frames[i].buf, frames[i].len,
+					frames[i].msg_dir, rx_time, NULL, 0, frame_crc);
+			la_acars_msg const *msg = results[i]->data;
+			if(!msg->err) {
+				ok_cnt++;
+			}
+		}
+	}
+	return ok_cnt;
+}
+
+// Same as la_acars_apps_parse_and_reassemble(), but uses the given settings
+// instead of the ones currently in effect (see la_decoder_config_set()).
+la_proto_node *la_acars_apps_parse_and_reassemble_with_config(char const *reg,
+		char const *label, char const *txt, la_msg_dir msg_dir,
+		la_reasm_ctx *rtables, struct timeval rx_time, la_decoder_config const *config) {
+	la_assert(config != NULL);
+	la_decoder_config const *prev = la_decoder_config_set(config);
+	la_proto_node *node = la_acars_apps_parse_and_reassemble(reg, label, txt, msg_dir,
+			rtables, rx_time);
+	la_decoder_config_set(prev);
+	return node;
+}
+
+// Same as la_acars_parse_and_reassemble(), but uses the given settings
+// instead of the ones currently in effect (see la_decoder_config_set()).
+// This allows decoding frames from several bearers in one process.
+la_proto_node *la_acars_parse_and_reassemble_with_config(uint8_t const *buf, int len,
+		la_msg_dir msg_dir, la_reasm_ctx *rtables, struct timeval rx_time,
+		la_decoder_config const *config) {
+	la_assert(config != NULL);
+	la_decoder_config const *prev = la_decoder_config_set(config);
+	la_proto_node *node = la_acars_parse_and_reassemble(buf, len, msg_dir, rtables, rx_time);
+	la_decoder_config_set(prev);
 	return node;
 }
 
@@ -504,6 +706,9 @@ void la_acars_format_text(la_vstring *vstr, void const *data, int indent) {
 	indent++;
 
 	LA_ISPRINTF(vstr, indent, "Reassembly: %s\n", la_reasm_status_name_get(msg->reasm_status));
+	if(msg->parity_errors > 0) {
+		LA_ISPRINTF(vstr, indent, "Parity errors: %d\n", msg->parity_errors);
+	}
 	LA_ISPRINTF(vstr, indent, "Reg: %s", msg->reg);
 	if(IS_DOWNLINK_BLK(msg->block_id)) {
 		la_vstring_append_sprintf(vstr, " Flight: %s\n", msg->flight_id);
@@ -528,7 +733,7 @@ void la_acars_format_text(la_vstring *vstr, void const *data, int indent) {
 	if(msg->txt[0] != '\0') {
 		bool prettify_xml = false;
 #ifdef WITH_LIBXML2
-		(void)la_config_get_bool("prettify_xml", &prettify_xml);
+		prettify_xml = la_decoder_config_get()->prettify_xml;
 		if(prettify_xml == true) {
 			xmlBufferPtr xmlbufptr = NULL;
 			if((xmlbufptr = la_prettify_xml(msg->txt)) != NULL) {
@@ -558,6 +763,7 @@ void la_acars_format_json(la_vstring *vstr, void const *data) {
 		return;
 	}
 	la_json_append_bool(vstr, "crc_ok", msg->crc_ok);
+	la_json_append_int64(vstr, "parity_errors", msg->parity_errors);
 	la_json_append_bool(vstr, "more", !msg->final_block);
 	la_json_append_string(vstr, "reg", msg->reg);
 	la_json_append_char(vstr, "mode", msg->mode);
@@ -583,7 +789,9 @@ void la_acars_destroy(void *data) {
 		return;
 	}
 	la_acars_msg *msg = data;
-	LA_XFREE(msg->txt);
+	if(!msg->txt_in_scratch) {
+		LA_XFREE(msg->txt);
+	}
 	LA_XFREE(data);
 }
 
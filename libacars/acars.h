@@ -43,8 +43,9 @@ typedef struct {
 	char flight_id[7];
 	la_reasm_status reasm_status;
 	char *txt;
+	bool txt_in_scratch;            // txt is a caller-supplied buffer, not owned by this struct
+	uint16_t parity_errors;         // number of characters with invalid parity bit
 	// reserved for future use
-	void (*reserved0)(void);
 	void (*reserved1)(void);
 	void (*reserved2)(void);
 	void (*reserved3)(void);
@@ -56,6 +57,16 @@ typedef struct {
 	void (*reserved9)(void);
 } la_acars_msg;
 
+// A single raw ACARS frame for la_acars_parse_batch()
+typedef struct {
+	uint8_t const *buf;
+	int len;
+	la_msg_dir msg_dir;
+// reserved for future use
+	void (*reserved0)(void);
+	void (*reserved1)(void);
+} la_acars_frame;
+
 // acars.c
 extern la_type_descriptor const la_DEF_acars_message;
 la_proto_node *la_acars_decode_apps(char const *label,
@@ -65,6 +76,17 @@ la_proto_node *la_acars_apps_parse_and_reassemble(char const *reg,
 		la_reasm_ctx *rtables, struct timeval rx_time);
 la_proto_node *la_acars_parse_and_reassemble(uint8_t const *buf, int len, la_msg_dir msg_dir,
 		la_reasm_ctx *rtables, struct timeval rx_time);
+la_proto_node *la_acars_apps_parse_and_reassemble_with_config(char const *reg,
+		char const *label, char const *txt, la_msg_dir msg_dir,
+		la_reasm_ctx *rtables, struct timeval rx_time, la_decoder_config const *config);
+la_proto_node *la_acars_parse_and_reassemble_with_config(uint8_t const *buf, int len,
+		la_msg_dir msg_dir, la_reasm_ctx *rtables, struct timeval rx_time,
+		la_decoder_config const *config);
+la_proto_node *la_acars_parse_and_reassemble_with_scratch(uint8_t const *buf, int len,
+		la_msg_dir msg_dir, la_reasm_ctx *rtables, struct timeval rx_time,
+		char *scratch, size_t scratch_len);
+size_t la_acars_parse_batch(la_acars_frame const *frames, size_t n,
+		struct timeval const *rx_times, la_reasm_ctx *rtables, la_proto_node **results);
 la_proto_node *la_acars_parse(uint8_t const *buf, int len, la_msg_dir msg_dir);
 int la_acars_extract_sublabel_and_mfi(char const *label, la_msg_dir msg_dir,
 		char const *txt, int len, char *sublabel, char *mfi);
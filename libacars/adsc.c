@@ -1619,6 +1619,7 @@ LA_ADSC_PARSER_FUN(la_adsc_contract_request_parse) {
 	int consumed_bytes = 0;
 	LA_NEW(la_adsc_req_t, r);
 	t->data = r;
+	la_list *tail = NULL;
 
 	r->contract_num = buf[0];
 	buf++; len--;
@@ -1633,7 +1634,7 @@ LA_ADSC_PARSER_FUN(la_adsc_contract_request_parse) {
 			break;
 		}
 		LA_NEW(la_adsc_tag_t, req_tag);
-		r->req_tag_list = la_list_append(r->req_tag_list, req_tag);
+		r->req_tag_list = la_list_append_with_tail(r->req_tag_list, &tail, req_tag);
 		if((consumed_bytes = la_adsc_tag_parse(req_tag, la_adsc_request_tag_descriptor_table, buf, len)) < 0) {
 			return -1;
 		}
@@ -1676,29 +1677,35 @@ la_proto_node *la_adsc_parse(uint8_t const *buf, int len, la_msg_dir msg_dir, la
 	if(buf == NULL)
 		return NULL;
 
+	LA_ALLOC_MODULE_ENTER(LA_ALLOC_MODULE_ADSC);
 	la_proto_node *node = la_proto_node_new();
 	LA_NEW(la_adsc_msg_t, msg);
 	node->data = msg;
 	node->td = &la_DEF_adsc_message;
 	la_adsc_tag_t *tag = NULL;
+	la_list *tail = NULL;
 	int consumed_bytes;
 
 	// Uplink and downlink tag values are the same, but their syntax is different.
 	// Figure out the dictionary to use based on the message direction.
-	static la_dict const *tag_table = NULL;
+	la_dict const *tag_table = NULL;
 	if(msg_dir == LA_MSG_DIR_GND2AIR)
 		tag_table = la_adsc_uplink_tag_descriptor_table;
 	else if(msg_dir == LA_MSG_DIR_AIR2GND)
 		tag_table = la_adsc_downlink_tag_descriptor_table;
-	la_assert(tag_table != NULL);
 
 	msg->err = false;
+	if(tag_table == NULL) {
+		la_debug_print(D_ERROR, "Unknown message direction\n");
+		msg->err = true;
+		imi = ARINC_MSG_UNKNOWN;
+	}
 	switch(imi) {
 		case ARINC_MSG_ADS:
 			while(len > 0) {
 				la_debug_print(D_INFO, "Remaining length: %u\n", len);
 				tag = LA_XCALLOC(1, sizeof(la_adsc_tag_t));
-				msg->tag_list = la_list_append(msg->tag_list, tag);
+				msg->tag_list = la_list_append_with_tail(msg->tag_list, &tail, tag);
 				if((consumed_bytes = la_adsc_tag_parse(tag, tag_table, buf, len)) < 0) {
 					msg->err = true;
 					break;
@@ -1728,6 +1735,7 @@ la_proto_node *la_adsc_parse(uint8_t const *buf, int len, la_msg_dir msg_dir, la
 		default:
 			break;
 	}
+	LA_ALLOC_MODULE_LEAVE();
 	return node;
 }
 
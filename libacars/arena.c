@@ -0,0 +1,248 @@
+/*
+ *  This file is a part of libacars
+ *
+ *  Copyright (c) 2018-2023 Tomasz Lemiech <szpajder@gmail.com>
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>                 // memset, memcpy
+#include <libacars/macros.h>        // la_assert, LA_MAX, LA_MIN, LA_THREAD_LOCAL
+#include <libacars/arena.h>         // la_arena
+#include <libacars/util.h>          // LA_HEAP_XCALLOC, LA_HEAP_XFREE
+
+// Memory arena for decoding messages. While an arena is set as the current
+// arena of a thread (with la_arena_set()), all allocations made by libacars
+// decoders in this thread (including the ASN.1 runtime) are carved from the
+// arena with a pointer bump. Freeing memory allocated from the arena is a no-op
+// (except for the most recent allocation, which is rolled back), so the whole
+// decoded tree is released at once with la_arena_reset().
+//
+// Modules which keep long-lived state (reassembly, la_hash, la_vec,
+// configuration) always allocate from the heap, regardless of the arena.
+
+#define LA_ARENA_DEFAULT_CHUNK_SIZE 65536
+#define LA_ARENA_ALIGN 16
+#define LA_ARENA_ROUNDUP(x) (((x) + LA_ARENA_ALIGN - 1) & ~(size_t)(LA_ARENA_ALIGN - 1))
+
+// Every allocation is preceded by a header holding its size,
+// which is needed when the allocation gets reallocated.
+typedef union {
+	size_t size;
+	uint8_t pad[LA_ARENA_ALIGN];
+} la_arena_hdr;
+
+typedef struct la_arena_chunk {
+	struct la_arena_chunk *next;
+	uint8_t *base;                      /* start of the usable area (aligned) */
+	size_t size;                        /* size of the usable area */
+	size_t used;                        /* bytes handed out from this chunk */
+	la_arena_hdr *last;                 /* most recent allocation (NULL if unknown) */
+} la_arena_chunk;
+
+struct la_arena_s {
+	la_arena_chunk *chunks;             /* chunks in use, the current one first */
+	la_arena_chunk *spare;              /* standard size chunks released by reset */
+	size_t chunk_size;                  /* standard chunk size */
+	size_t bytes_allocated;             /* total size of all chunks */
+	size_t peak_bytes_used;
+};
+
+static LA_THREAD_LOCAL la_arena *la_current_arena = NULL;
+
+static la_arena_chunk *la_arena_chunk_new(size_t size) {
+	la_arena_chunk *chunk = LA_HEAP_XCALLOC(1, sizeof(la_arena_chunk) + size + LA_ARENA_ALIGN);
+	uintptr_t base = (uintptr_t)(chunk + 1);
+	chunk->base = (uint8_t *)LA_ARENA_ROUNDUP(base);
+	chunk->size = size;
+	return chunk;
+}
+
+// Returns a chunk with at least need bytes of free space, making it
+// the current chunk (or the second one, if it's an oversized chunk, so that
+// the free space in the current chunk does not go to waste).
+static la_arena_chunk *la_arena_chunk_get(la_arena *arena, size_t need) {
+	la_arena_chunk *chunk = NULL;
+	bool oversized = need > arena->chunk_size;
+	if(!oversized && arena->spare != NULL) {
+		chunk = arena->spare;
+		arena->spare = chunk->next;
+	} else {
+		chunk = la_arena_chunk_new(LA_MAX(need, arena->chunk_size));
+		arena->bytes_allocated += chunk->size;
+	}
+	chunk->used = 0;
+	chunk->last = NULL;
+	if(oversized && arena->chunks != NULL) {
+		chunk->next = arena->chunks->next;
+		arena->chunks->next = chunk;
+	} else {
+		chunk->next = arena->chunks;
+		arena->chunks = chunk;
+	}
+	return chunk;
+}
+
+static la_arena_chunk *la_arena_chunk_find(la_arena const *arena, void const *ptr) {
+	uint8_t const *p = ptr;
+	for(la_arena_chunk *chunk = arena->chunks; chunk != NULL; chunk = chunk->next) {
+		if(p > chunk->base && p < chunk->base + chunk->used) {
+			return chunk;
+		}
+	}
+	return NULL;
+}
+
+static void *la_arena_alloc_uninitialized(la_arena *arena, size_t size) {
+	size_t need = sizeof(la_arena_hdr) + LA_ARENA_ROUNDUP(size);
+	la_arena_chunk *chunk = arena->chunks;
+	if(chunk == NULL || chunk->size - chunk->used < need) {
+		chunk = la_arena_chunk_get(arena, need);
+	}
+	la_arena_hdr *hdr = (la_arena_hdr *)(chunk->base + chunk->used);
+	hdr->size = size;
+	chunk->used += need;
+	chunk->last = hdr;
+	return hdr + 1;
+}
+
+// Allocates zeroed memory for nmemb elements of the given size.
+// Returns NULL if the total size overflows.
+void *la_arena_alloc(la_arena *arena, size_t nmemb, size_t size) {
+	la_assert(arena != NULL);
+	if(size != 0 && nmemb > (SIZE_MAX - 2 * LA_ARENA_ALIGN) / size) {
+		return NULL;
+	}
+	void *ptr = la_arena_alloc_uninitialized(arena, nmemb * size);
+	memset(ptr, 0, nmemb * size);
+	return ptr;
+}
+
+// Reallocates ptr, if it's NULL or if it has been allocated from the arena.
+// The most recent allocation is resized in place, if the chunk has enough
+// room. Returns false if ptr does not belong to the arena (the caller shall
+// then reallocate it on the heap). Sets *result to NULL if the size overflows.
+bool la_arena_realloc(la_arena *arena, void *ptr, size_t size, void **result) {
+	la_assert(arena != NULL);
+	la_assert(result != NULL);
+	la_arena_chunk *chunk = NULL;
+	if(ptr != NULL && (chunk = la_arena_chunk_find(arena, ptr)) == NULL) {
+		return false;
+	}
+	if(size > SIZE_MAX - 2 * LA_ARENA_ALIGN) {
+		*result = NULL;
+		return true;
+	}
+	if(ptr == NULL) {
+		*result = la_arena_alloc_uninitialized(arena, size);
+		return true;
+	}
+	la_arena_hdr *hdr = (la_arena_hdr *)ptr - 1;
+	if(hdr == chunk->last) {
+		size_t offset = (uint8_t *)ptr - chunk->base;
+		size_t need = LA_ARENA_ROUNDUP(size);
+		if(chunk->size - offset >= need) {
+			hdr->size = size;
+			chunk->used = offset + need;
+			*result = ptr;
+			return true;
+		}
+	}
+	void *new_ptr = la_arena_alloc_uninitialized(arena, size);
+	memcpy(new_ptr, ptr, LA_MIN(hdr->size, size));
+	*result = new_ptr;
+	return true;
+}
+
+// Releases ptr, if it has been allocated from the arena. Only the most
+// recent allocation is actually reclaimed. Returns false if ptr does not
+// belong to the arena (the caller shall then free it).
+bool la_arena_free(la_arena *arena, void *ptr) {
+	la_assert(arena != NULL);
+	la_arena_chunk *chunk = la_arena_chunk_find(arena, ptr);
+	if(chunk == NULL) {
+		return false;
+	}
+	la_arena_hdr *hdr = (la_arena_hdr *)ptr - 1;
+	if(hdr == chunk->last) {
+		chunk->used = (uint8_t *)hdr - chunk->base;
+		chunk->last = NULL;
+	}
+	return true;
+}
+
+/********************************************************************************
+ * Public API
+ ********************************************************************************/
+
+// Creates a new arena, which allocates memory from the heap in chunks
+// of chunk_size bytes (0 selects the default size). Allocations larger
+// than chunk_size get dedicated chunks.
+la_arena *la_arena_new(size_t chunk_size) {
+	LA_HEAP_NEW(la_arena, arena);
+	arena->chunk_size = chunk_size > 0 ? LA_ARENA_ROUNDUP(chunk_size) : LA_ARENA_DEFAULT_CHUNK_SIZE;
+	return arena;
+}
+
+// Sets the current arena of the calling thread (NULL disables arena
+// allocation). Returns the previous one.
+la_arena *la_arena_set(la_arena *arena) {
+	la_arena *prev = la_current_arena;
+	la_current_arena = arena;
+	return prev;
+}
+
+la_arena *la_arena_get(void) {
+	return la_current_arena;
+}
+
+static size_t la_arena_bytes_used(la_arena const *arena) {
+	size_t bytes_used = 0;
+	for(la_arena_chunk const *chunk = arena->chunks; chunk != NULL; chunk = chunk->next) {
+		bytes_used += chunk->used;
+	}
+	return bytes_used;
+}
+
+// Releases all memory allocated from the arena. Standard size chunks are
+// kept for reuse, oversized chunks are freed.
+void la_arena_reset(la_arena *arena) {
+	la_assert(arena != NULL);
+	arena->peak_bytes_used = LA_MAX(arena->peak_bytes_used, la_arena_bytes_used(arena));
+	la_arena_chunk *next = NULL;
+	for(la_arena_chunk *chunk = arena->chunks; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		if(chunk->size == arena->chunk_size) {
+			chunk->next = arena->spare;
+			arena->spare = chunk;
+		} else {
+			arena->bytes_allocated -= chunk->size;
+			LA_HEAP_XFREE(chunk);
+		}
+	}
+	arena->chunks = NULL;
+}
+
+void la_arena_stats_get(la_arena const *arena, la_arena_stats *result) {
+	la_assert(arena != NULL);
+	la_assert(result != NULL);
+	result->bytes_used = la_arena_bytes_used(arena);
+	result->bytes_allocated = arena->bytes_allocated;
+	result->peak_bytes_used = LA_MAX(arena->peak_bytes_used, result->bytes_used);
+}
+
+void la_arena_destroy(la_arena *arena) {
+	if(arena == NULL) {
+		return;
+	}
+	if(la_current_arena == arena) {
+		la_current_arena = NULL;
+	}
+	la_arena_reset(arena);
+	la_arena_chunk *next = NULL;
+	for(la_arena_chunk *chunk = arena->spare; chunk != NULL; chunk = next) {
+		next = chunk->next;
+		LA_HEAP_XFREE(chunk);
+	}
+	LA_HEAP_XFREE(arena);
+}
@@ -0,0 +1,42 @@
+/*
+ *  This file is a part of libacars
+ *
+ *  Copyright (c) 2018-2023 Tomasz Lemiech <szpajder@gmail.com>
+ */
+#ifndef LA_ARENA_H
+#define LA_ARENA_H 1
+
+#include <stddef.h>     // size_t
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct la_arena_s la_arena;
+
+typedef struct {
+	size_t bytes_used;              /* memory handed out since the last reset */
+
+	size_t bytes_allocated;         /* memory held by the arena (all chunks) */
+
+	size_t peak_bytes_used;         /* maximum bytes_used between resets */
+// reserved for future use
+	void (*reserved0)(void);
+	void (*reserved1)(void);
+	void (*reserved2)(void);
+	void (*reserved3)(void);
+} la_arena_stats;
+
+// arena.c
+la_arena *la_arena_new(size_t chunk_size);
+la_arena *la_arena_set(la_arena *arena);
+la_arena *la_arena_get(void);
+void la_arena_reset(la_arena *arena);
+void la_arena_stats_get(la_arena const *arena, la_arena_stats *result);
+void la_arena_destroy(la_arena *arena);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !LA_ARENA_H
@@ -163,7 +163,7 @@ static bool la_is_crc_ok(char const *text_part, uint8_t const *binary_part, size
 	return result;
 }
 
-la_proto_node *la_arinc_parse(char const *txt, la_msg_dir msg_dir) {
+static la_proto_node *la_arinc_parse_internal(char const *txt, la_msg_dir msg_dir) {
 	if(txt == NULL) {
 		return NULL;
 	}
@@ -218,6 +218,13 @@ cleanup:
 	return NULL;
 }
 
+la_proto_node *la_arinc_parse(char const *txt, la_msg_dir msg_dir) {
+	LA_ALLOC_MODULE_ENTER(LA_ALLOC_MODULE_ARINC);
+	la_proto_node *node = la_arinc_parse_internal(txt, msg_dir);
+	LA_ALLOC_MODULE_LEAVE();
+	return node;
+}
+
 void la_arinc_format_text(la_vstring *vstr, void const *data, int indent) {
 	la_assert(vstr);
 	la_assert(data);
@@ -8,8 +8,9 @@
 #include <search.h>                         // lfind()
 #include <libacars/asn1/asn_application.h>  // asn_TYPE_descriptor_t
 #include <libacars/asn1-util.h>             // la_asn1_formatter
-#include <libacars/macros.h>                // LA_ISPRINTF, la_debug_print
+#include <libacars/macros.h>                // la_assert, LA_ISPRINTF, la_debug_print
 #include <libacars/vstring.h>               // la_vstring
+#include <libacars/util.h>                  // LA_HEAP_XREALLOC, LA_HEAP_XFREE
 #include "config.h"                         // LFIND_NMEMB_SIZE_SIZE_T, LFIND_NMEMB_SIZE_UINT
 
 static int la_compare_fmtr(void const *k, void const *m) {
@@ -17,6 +18,46 @@ static int la_compare_fmtr(void const *k, void const *m) {
 	return(k == memb->type ? 0 : 1);
 }
 
+// asn1c implements types derived from other types (eg. FANSTimehours ::=
+// INTEGER (0..23)) with wrappers which copy methods of the base type into the
+// type descriptor on every call and then call the base method. These writes
+// to global descriptors race when messages are decoded by several threads.
+// Once the methods have been copied, the wrappers are no longer called, so
+// this is done in advance for td and all types reachable from it.
+typedef struct {
+	asn_TYPE_descriptor_t **types;
+	size_t len;
+	size_t size;
+} la_asn1_type_set;
+
+static void la_asn1_descriptor_init_recursive(asn_TYPE_descriptor_t *td, la_asn1_type_set *visited) {
+	for(size_t i = 0; i < visited->len; i++) {
+		if(visited->types[i] == td) {
+			return;
+		}
+	}
+	if(visited->len == visited->size) {
+		visited->size = visited->size > 0 ? 2 * visited->size : 256;
+		visited->types = LA_HEAP_XREALLOC(visited->types, visited->size * sizeof(asn_TYPE_descriptor_t *));
+	}
+	visited->types[visited->len++] = td;
+	// Freeing a NULL pointer does nothing except for copying the methods
+	td->free_struct(td, NULL, 0);
+	for(int i = 0; i < td->elements_count; i++) {
+		la_asn1_descriptor_init_recursive(td->elements[i].type, visited);
+	}
+}
+
+// Prepares td for use by multiple threads. Must be called before td is
+// used for the first time and must not be called concurrently.
+void la_asn1_descriptor_init(asn_TYPE_descriptor_t *td) {
+	la_assert(td != NULL);
+	la_asn1_type_set visited = { 0 };
+	la_asn1_descriptor_init_recursive(td, &visited);
+	la_debug_print(D_INFO, "%s: %zu types initialized\n", td->name, visited.len);
+	LA_HEAP_XFREE(visited.types);
+}
+
 int la_asn1_decode_as(asn_TYPE_descriptor_t *td, void **struct_ptr, uint8_t const *buf, int size) {
 	asn_dec_rval_t rval;
 	rval = uper_decode_complete(0, td, struct_ptr, buf, size);
@@ -23,10 +23,19 @@ extern "C" {
 #define	ASN1C_ENVIRONMENT_VERSION	923	/* Compile-time version */
 int get_asn1c_environment_version(void);	/* Run-time version */
 
-#define	CALLOC(nmemb, size)	calloc(nmemb, size)
-#define	MALLOC(size)		malloc(size)
-#define	REALLOC(oldptr, size)	realloc(oldptr, size)
-#define	FREEMEM(ptr)		free(ptr)
+/*
+ * libacars: route allocations through libacars allocation functions,
+ * so that decoded structures are carved from the current arena of the thread,
+ * if it's set (see la_arena_set()), or allocated with the allocator set with
+ * la_set_allocator().
+ */
+void *la_xcalloc(size_t nmemb, size_t size, char const *file, int line, char const *func);
+void *la_xrealloc(void *ptr, size_t size, char const *file, int line, char const *func);
+void la_xfree(void *ptr);
+#define	CALLOC(nmemb, size)	la_xcalloc((nmemb), (size), __FILE__, __LINE__, __func__)
+#define	MALLOC(size)		la_xcalloc(1, (size), __FILE__, __LINE__, __func__)
+#define	REALLOC(oldptr, size)	la_xrealloc((oldptr), (size), __FILE__, __LINE__, __func__)
+#define	FREEMEM(ptr)		la_xfree(ptr)
 
 #define	asn_debug_indent	0
 #define ASN_DEBUG_INDENT_ADD(i) do{}while(0)
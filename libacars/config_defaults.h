@@ -25,6 +25,13 @@
 
 	LA_CONFIG_SETTING_INTEGER("acars_bearer", 1),
 
+// Shorten ACARS reassembly timeouts based on observed time gaps between
+// blocks of messages with the same bearer, direction and label? Timeouts
+// specified by ARINC 618 (see acars_bearer) still apply as the upper limit.
+// If reassembly is disabled, this setting has no effect.
+
+	LA_CONFIG_SETTING_BOOLEAN("acars_adaptive_timeouts", false),
+
 // Pretty-print XML in ACARS and MIAM Core payloads?
 
 	LA_CONFIG_SETTING_BOOLEAN("prettify_xml", false),
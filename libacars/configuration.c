@@ -5,9 +5,15 @@
  */
 
 #include <stdbool.h>
-#include <string.h>                 // strdup
-#include <libacars/macros.h>        // la_assert
-#include <libacars/util.h>          // LA_XCALLOC, LA_XFREE
+#include <string.h>                 // strcmp
+#include "config.h"                 // WITH_PTHREADS
+#ifdef WITH_PTHREADS
+#include <pthread.h>                // pthread_mutex_*, pthread_once
+#endif
+#include <libacars/macros.h>        // la_assert, LA_THREAD_LOCAL
+#include <libacars/libacars.h>      // la_decoder_config
+#include <libacars/acars.h>         // LA_ACARS_BEARER_INVALID
+#include <libacars/util.h>          // LA_HEAP_NEW, LA_HEAP_XSTRDUP, LA_XFREE
 #include <libacars/hash.h>          // la_hash
 
 typedef enum {
@@ -55,120 +61,229 @@ static const la_config_option config_defaults[] =
 #define CONFIG_DEFAULTS_COUNT (sizeof(config_defaults) / sizeof(la_config_option))
 
 static la_hash *config = NULL;
-static void la_config_init();
+
+// Settings used by decoders, compiled from the config hash whenever
+// it changes, so that decoders don't need to look them up by name.
+static la_decoder_config compiled_config;
+
+// Settings used by the calling thread instead of compiled_config
+// (see la_decoder_config_set()).
+static LA_THREAD_LOCAL la_decoder_config const *thread_config = NULL;
+
+#ifdef WITH_PTHREADS
+// Guards config and compiled_config. Decoders read compiled_config
+// without locking - see "Thread safety" in API_REFERENCE.md.
+static pthread_mutex_t config_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t compiled_config_once = PTHREAD_ONCE_INIT;
+#else
+static bool compiled_config_ready = false;
+#endif
+
+static void la_config_init_unlocked();
+
+static void la_config_lock() {
+#ifdef WITH_PTHREADS
+	pthread_mutex_lock(&config_lock);
+#endif
+}
+
+static void la_config_unlock() {
+#ifdef WITH_PTHREADS
+	pthread_mutex_unlock(&config_lock);
+#endif
+}
+
+/********************************************************************************
+ * Compiled settings
+ ********************************************************************************/
+
+typedef la_config_item const *(la_config_lookup_func)(char const *name);
+
+static la_config_item const *la_config_current_lookup(char const *name) {
+	return la_hash_lookup(config, name);
+}
+
+static la_config_item const *la_config_default_lookup(char const *name) {
+	for(size_t i = 0; i < CONFIG_DEFAULTS_COUNT; i++) {
+		if(!strcmp(config_defaults[i].name, name)) {
+			return &config_defaults[i].value;
+		}
+	}
+	return NULL;
+}
+
+static void la_config_compile_bool(la_config_lookup_func *lookup, char const *name, bool *result) {
+	la_config_item const *item = lookup(name);
+	if(item != NULL && item->type == LA_CONFVAR_BOOLEAN) {
+		*result = item->value._bool;
+	}
+}
+
+static void la_config_compile_int(la_config_lookup_func *lookup, char const *name, long int *result) {
+	la_config_item const *item = lookup(name);
+	if(item != NULL && item->type == LA_CONFVAR_INTEGER) {
+		*result = item->value._int;
+	}
+}
+
+// Must be called with config_lock held
+static void la_config_compile(la_config_lookup_func *lookup) {
+	// Defaults used when a setting has been unset (or has a wrong type)
+	la_decoder_config c = {
+		.dump_asn1 = false,
+		.decode_fragments = true,
+		.acars_bearer = LA_ACARS_BEARER_INVALID,
+		.acars_adaptive_timeouts = false,
+		.prettify_xml = false,
+		.prettify_json = false
+	};
+	la_config_compile_bool(lookup, "dump_asn1", &c.dump_asn1);
+	la_config_compile_bool(lookup, "decode_fragments", &c.decode_fragments);
+	la_config_compile_int(lookup, "acars_bearer", &c.acars_bearer);
+	la_config_compile_bool(lookup, "acars_adaptive_timeouts", &c.acars_adaptive_timeouts);
+	la_config_compile_bool(lookup, "prettify_xml", &c.prettify_xml);
+	la_config_compile_bool(lookup, "prettify_json", &c.prettify_json);
+	compiled_config = c;
+}
+
+// Called once, on first use of compiled_config. When la_config_get_*()
+// creates the config on first use, it does not compile it (the values are
+// defaults anyway), so that decoders running at that time are not disturbed.
+static void la_config_compile_initial() {
+	la_config_lock();
+	la_config_compile(config != NULL ? la_config_current_lookup : la_config_default_lookup);
+	la_config_unlock();
+}
+
+/********************************************************************************
+ * Config variables
+ ********************************************************************************/
 
 // Sets the given config option to the given type/value.
 // Returns true if the option already existed in the config, false otherwise.
+// Must be called with config_lock held.
 static bool la_config_option_set(char const *name, la_config_item const item) {
 	la_assert(name != NULL);
 	la_assert(item.type >= 0);
 	la_assert(item.type <= LA_CONFIG_ITEM_TYPE_MAX);
 
 	if(config == NULL) {
-		la_config_init();
+		la_config_init_unlocked();
 	}
-	LA_NEW(la_config_item, new_item);
-	char *new_name = strdup(name);
+	LA_HEAP_NEW(la_config_item, new_item);
+	char *new_name = LA_HEAP_XSTRDUP(name);
 	new_item->type = item.type;
 	new_item->value = item.value;
 	return la_hash_insert(config, new_name, new_item);
 }
 
-bool la_config_set_bool(char const *name, bool value) {
+static bool la_config_set(char const *name, la_config_item const item) {
 	if(name == NULL) {
 		return false;
 	}
-	(void)la_config_option_set(name, (la_config_item){
+	la_config_lock();
+	(void)la_config_option_set(name, item);
+	la_config_compile(la_config_current_lookup);
+	la_config_unlock();
+	return true;
+}
+
+bool la_config_set_bool(char const *name, bool value) {
+	return la_config_set(name, (la_config_item){
 			.type = LA_CONFVAR_BOOLEAN,
 			.value = { ._bool = value }
 			});
-	return true;
 }
 
 bool la_config_set_int(char const *name, long int value) {
-	if(name == NULL) {
-		return false;
-	}
-	(void)la_config_option_set(name, (la_config_item){
+	return la_config_set(name, (la_config_item){
 			.type = LA_CONFVAR_INTEGER,
 			.value = { ._int = value }
 			});
-	return true;
 }
 
 bool la_config_set_double(char const *name, double value) {
-	if(name == NULL) {
-		return false;
-	}
-	(void)la_config_option_set(name, (la_config_item){
+	return la_config_set(name, (la_config_item){
 			.type = LA_CONFVAR_DOUBLE,
 			.value = { ._double = value }
 			});
-	return true;
 }
 
 bool la_config_set_str(char const *name, char const *value) {
 	if(name == NULL) {
 		return false;
 	}
-	(void)la_config_option_set(name, (la_config_item){
+	return la_config_set(name, (la_config_item){
 			.type = LA_CONFVAR_STRING,
-			.value = { ._str = value ? strdup(value) : NULL }
+			.value = { ._str = value ? LA_HEAP_XSTRDUP(value) : NULL }
 			});
-	return true;
 }
 
-static la_config_item *la_config_option_get(char const *name) {
+// Looks up the given config option and copies it into *result.
+// Returns false if the option does not exist or is of a different type.
+static bool la_config_option_get(char const *name, la_config_item_type type,
+		la_config_item_value *result) {
 	if(name == NULL) {
 		return false;
 	}
+	la_config_lock();
 	if(config == NULL) {
-		la_config_init();
+		la_config_init_unlocked();
 	}
-	return la_hash_lookup(config, name);
+	la_config_item const *item = la_hash_lookup(config, name);
+	bool found = item != NULL && item->type == type;
+	if(found) {
+		*result = item->value;
+	}
+	la_config_unlock();
+	return found;
 }
 
 bool la_config_get_bool(char const *name, bool *result) {
-	la_config_item *item = la_config_option_get(name);
-	if(item && item->type == LA_CONFVAR_BOOLEAN) {
-		*result = item->value._bool;
+	la_config_item_value value;
+	if(la_config_option_get(name, LA_CONFVAR_BOOLEAN, &value)) {
+		*result = value._bool;
 		return true;
 	}
 	return false;
 }
 
 bool la_config_get_int(char const *name, long int *result) {
-	la_config_item *item = la_config_option_get(name);
-	if(item && item->type == LA_CONFVAR_INTEGER) {
-		*result = item->value._int;
+	la_config_item_value value;
+	if(la_config_option_get(name, LA_CONFVAR_INTEGER, &value)) {
+		*result = value._int;
 		return true;
 	}
 	return false;
 }
 
 bool la_config_get_double(char const *name, double *result) {
-	la_config_item *item = la_config_option_get(name);
-	if(item && item->type == LA_CONFVAR_DOUBLE) {
-		*result = item->value._double;
+	la_config_item_value value;
+	if(la_config_option_get(name, LA_CONFVAR_DOUBLE, &value)) {
+		*result = value._double;
 		return true;
 	}
 	return false;
 }
 
 bool la_config_get_str(char const *name, char **result) {
-	la_config_item *item = la_config_option_get(name);
-	if(item && item->type == LA_CONFVAR_STRING) {
-		*result = item->value._str;
+	la_config_item_value value;
+	if(la_config_option_get(name, LA_CONFVAR_STRING, &value)) {
+		*result = value._str;
 		return true;
 	}
 	return false;
 }
 
 bool la_config_unset(char *name) {
+	la_config_lock();
 	if(config == NULL) {
-		la_config_init();
+		la_config_init_unlocked();
 	}
-	return la_hash_remove(config, name);
+	bool result = la_hash_remove(config, name);
+	la_config_compile(la_config_current_lookup);
+	la_config_unlock();
+	return result;
 }
 
 static void la_config_item_destroy(void *data) {
@@ -182,23 +297,74 @@ static void la_config_item_destroy(void *data) {
 	LA_XFREE(item);
 }
 
-void la_config_destroy() {
+static void la_config_destroy_unlocked() {
 	la_hash_destroy(config);
+	config = NULL;
 }
 
-void la_config_init() {
+void la_config_destroy() {
+	la_config_lock();
+	la_config_destroy_unlocked();
+	// The config will be recreated with default values on next use
+	la_config_compile(la_config_default_lookup);
+	la_config_unlock();
+}
+
+static void la_config_init_unlocked() {
 	if(config != NULL) {
-		la_config_destroy();
+		la_config_destroy_unlocked();
 	}
 	config = la_hash_new(la_hash_key_str, la_hash_compare_keys_str,
 			la_simple_free, la_config_item_destroy);
 	la_assert(config != NULL);
 	for(size_t i = 0; i < CONFIG_DEFAULTS_COUNT; i++) {
 		la_config_option const *opt = config_defaults + i;
-		if(opt->value.type == LA_CONFVAR_STRING) {
-			(void)la_config_set_str(opt->name, opt->value.value._str);
-		} else {
-			(void)la_config_option_set(opt->name, opt->value);
+		la_config_item item = opt->value;
+		if(item.type == LA_CONFVAR_STRING && item.value._str != NULL) {
+			item.value._str = LA_HEAP_XSTRDUP(item.value._str);
 		}
+		(void)la_config_option_set(opt->name, item);
+	}
+}
+
+void la_config_init() {
+	la_config_lock();
+	la_config_init_unlocked();
+	la_config_compile(la_config_current_lookup);
+	la_config_unlock();
+}
+
+/********************************************************************************
+ * Decoder settings
+ ********************************************************************************/
+
+// Fills config with the current values of global settings.
+void la_decoder_config_init(la_decoder_config *config) {
+	la_assert(config != NULL);
+	*config = *la_decoder_config_get();
+}
+
+// Sets the settings to be used by decoders and formatters called by the
+// current thread (NULL restores global settings). Returns the previous ones.
+// config is not copied, so it must remain valid while it's in use.
+la_decoder_config const *la_decoder_config_set(la_decoder_config const *config) {
+	la_decoder_config const *prev = thread_config;
+	thread_config = config;
+	return prev;
+}
+
+// Returns settings in effect in the calling thread
+la_decoder_config const *la_decoder_config_get() {
+	if(thread_config != NULL) {
+		return thread_config;
+	}
+#ifdef WITH_PTHREADS
+	pthread_once(&compiled_config_once, la_config_compile_initial);
+#else
+	if(!compiled_config_ready) {
+		la_config_compile_initial();
+		compiled_config_ready = true;
 	}
+#endif
+	return &compiled_config;
 }
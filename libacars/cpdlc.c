@@ -8,20 +8,35 @@
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include "config.h"                                 // WITH_PTHREADS
+#ifdef WITH_PTHREADS
+#include <pthread.h>                                // pthread_once
+#endif
 #include <libacars/asn1/FANSATCDownlinkMessage.h>   // asn_DEF_FANSATCDownlinkMessage
 #include <libacars/asn1/FANSATCUplinkMessage.h>     // asn_DEF_FANSATCUplinkMessage
 #include <libacars/asn1/asn_application.h>          // asn_sprintf()
 #include <libacars/macros.h>                        // la_assert
-#include <libacars/asn1-util.h>                     // la_asn1_decode_as()
+#include <libacars/asn1-util.h>                     // la_asn1_decode_as(), la_asn1_descriptor_init()
 #include <libacars/asn1-format-cpdlc.h>             // la_asn1_output_cpdlc_as_*()
 #include <libacars/cpdlc.h>                         // la_cpdlc_msg
-#include <libacars/libacars.h>                      // la_proto_node, la_config_get_bool, la_proto_tree_find_protocol
+#include <libacars/libacars.h>                      // la_proto_node, la_decoder_config_get, la_proto_tree_find_protocol
 #include <libacars/macros.h>                        // la_debug_print
 #include <libacars/util.h>                          // LA_XFREE
 #include <libacars/vstring.h>                       // la_vstring, la_vstring_append_sprintf()
 #include <libacars/json.h>                          // la_json_append_bool()
 
-la_proto_node *la_cpdlc_parse(uint8_t const *buf, int len, la_msg_dir msg_dir) {
+#ifdef WITH_PTHREADS
+static pthread_once_t la_cpdlc_asn1_once = PTHREAD_ONCE_INIT;
+#else
+static bool la_cpdlc_asn1_initialized = false;
+#endif
+
+static void la_cpdlc_asn1_init() {
+	la_asn1_descriptor_init(&asn_DEF_FANSATCUplinkMessage);
+	la_asn1_descriptor_init(&asn_DEF_FANSATCDownlinkMessage);
+}
+
+static la_proto_node *la_cpdlc_parse_internal(uint8_t const *buf, int len, la_msg_dir msg_dir) {
 	if(buf == NULL)
 		return NULL;
 
@@ -42,6 +57,14 @@ la_proto_node *la_cpdlc_parse(uint8_t const *buf, int len, la_msg_dir msg_dir) {
 		return node;
 	}
 
+#ifdef WITH_PTHREADS
+	pthread_once(&la_cpdlc_asn1_once, la_cpdlc_asn1_init);
+#else
+	if(!la_cpdlc_asn1_initialized) {
+		la_cpdlc_asn1_init();
+		la_cpdlc_asn1_initialized = true;
+	}
+#endif
 	la_debug_print(D_INFO, "Decoding as %s, len: %d\n", msg->asn_type->name, len);
 	if(la_asn1_decode_as(msg->asn_type, &msg->data, buf, len) != 0) {
 		msg->err = true;
@@ -51,6 +74,13 @@ la_proto_node *la_cpdlc_parse(uint8_t const *buf, int len, la_msg_dir msg_dir) {
 	return node;
 }
 
+la_proto_node *la_cpdlc_parse(uint8_t const *buf, int len, la_msg_dir msg_dir) {
+	LA_ALLOC_MODULE_ENTER(LA_ALLOC_MODULE_CPDLC);
+	la_proto_node *node = la_cpdlc_parse_internal(buf, len, msg_dir);
+	LA_ALLOC_MODULE_LEAVE();
+	return node;
+}
+
 void la_cpdlc_format_text(la_vstring *vstr, void const *data, int indent) {
 	la_assert(vstr);
 	la_assert(data);
@@ -63,9 +93,7 @@ void la_cpdlc_format_text(la_vstring *vstr, void const *data, int indent) {
 	}
 	if(msg->asn_type != NULL) {
 		if(msg->data != NULL) {
-			bool dump_asn1 = false;
-			(void)la_config_get_bool("dump_asn1", &dump_asn1);
-			if(dump_asn1 == true) {
+			if(la_decoder_config_get()->dump_asn1 == true) {
 				LA_ISPRINTF(vstr, indent, "ASN.1 dump:\n");
 				// asn_fprint does not indent the first line
 				LA_ISPRINTF(vstr, indent + 1, "");
@@ -7,11 +7,14 @@
 #ifndef LA_CRC_ARINC_H
 #define LA_CRC_ARINC_H
 
+#include <stddef.h>
 #include <stdint.h>
 #include <stdbool.h>
 
 uint16_t la_crc16_arinc(uint8_t const *data, uint32_t len, uint16_t crc_init);
 uint16_t la_crc16_ccitt(uint8_t const *data, uint32_t len, uint16_t crc_init);
+void la_crc16_ccitt_multi(uint8_t const * const *data, uint32_t const *len, size_t n,
+		uint16_t crc_init, uint16_t *crc);
 uint32_t la_crc32_arinc665(uint8_t const *data, uint32_t len, uint32_t crc_init);
 
 #endif // !LA_CRC_ARINC_H
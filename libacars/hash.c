@@ -6,33 +6,140 @@
 
 #include <stdbool.h>
 #include <stdint.h>
-#include <string.h>                     // strcmp
+#include <string.h>                     // strcmp, strlen, memcpy
+#include "config.h"                     // WITH_PTHREADS
+#ifdef WITH_PTHREADS
+#include <pthread.h>                    // pthread_mutex_*
+#endif
 #include <libacars/macros.h>            // la_assert
 #include <libacars/hash.h>              // la_hash
-#include <libacars/list.h>              // la_list
-#include <libacars/util.h>              // LA_XCALLOC, LA_XFREE
+#include <libacars/util.h>              // LA_HEAP_XCALLOC, LA_XFREE
 
-#define LA_HASH_SIZE 173
+// Open-addressing hash table with linear probing. Key/value pairs are stored
+// inline in the slot array, together with the full hash value of the key, so
+// that insert, lookup and remove do not allocate memory (except when the
+// table needs to grow) and rehashing does not call compute_hash() again.
+// Deletions use backward shift instead of tombstones, so probe sequences
+// never get polluted by deleted entries.
+// The slot count is always a power of two.
+
+#define LA_HASH_MIN_SIZE 16
+// Grow when the table gets more than 3/4 full, shrink when it gets
+// less than 1/8 full.
+#define LA_HASH_GROW_THRESHOLD(size) ((size) - (size) / 4)
+#define LA_HASH_SHRINK_THRESHOLD(size) ((size) / 8)
+
+typedef struct {
+	void *key;                          // NULL means that the slot is empty
+	void *value;
+	uint32_t hash;                      // full hash value of the key
+} la_hash_slot;
 
 struct la_hash_s {
 	la_hash_func *compute_hash;
 	la_hash_compare_func *compare_keys;
 	la_hash_key_destroy_func *destroy_key;
 	la_hash_value_destroy_func *destroy_value;
-	la_list *buckets[LA_HASH_SIZE];
+	la_hash_slot *slots;
+	size_t size;                        // number of slots (power of two)
+	size_t count;                       // number of occupied slots
 };
 
-typedef struct {
-	void *key;
-	void *value;
-} la_hash_element;
+// String and fixed-width key hash. Input is consumed in 64-bit words using
+// the MurmurHash64A mixing step, so that keys differing in a single character
+// (eg. registrations sharing a common prefix) end up far apart. The state is
+// seeded with a process-wide seed, which may be randomized by the application
+// with la_hash_seed_set() to make hash flooding with crafted keys impractical.
+// Hash values computed with different seeds are not comparable, so the seed
+// gets frozen when the first hash table is created and can't be changed
+// afterwards.
 
-uint32_t la_hash_string(char const *str, uint32_t h) {
-	int h_work = (int)h;
-	for(char const *p = str; *p != '\0'; p++) {
-		h_work = h_work * LA_HASH_MULTIPLIER + (int)(*p);
+#define LA_HASH_M 0xc6a4a7935bd1e995ULL
+#define LA_HASH_R 47
+
+static uint32_t la_hash_seed = 0x5bd1e995U;
+static bool la_hash_seed_frozen = false;
+#ifdef WITH_PTHREADS
+// Guards la_hash_seed_frozen and writes to la_hash_seed
+static pthread_mutex_t la_hash_seed_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+static void la_hash_seed_lock_acquire(void) {
+#ifdef WITH_PTHREADS
+	pthread_mutex_lock(&la_hash_seed_lock);
+#endif
+}
+
+static void la_hash_seed_lock_release(void) {
+#ifdef WITH_PTHREADS
+	pthread_mutex_unlock(&la_hash_seed_lock);
+#endif
+}
+
+static void la_hash_seed_freeze(void) {
+	la_hash_seed_lock_acquire();
+	la_hash_seed_frozen = true;
+	la_hash_seed_lock_release();
+}
+
+// Sets the seed of la_hash_bytes(), la_hash_string() and la_hash_key_str().
+// Returns false (and leaves the seed intact) if any hash table (including
+// the ones created internally by libacars for configuration and reassembly
+// contexts) has already been created.
+bool la_hash_seed_set(uint32_t seed) {
+	la_hash_seed_lock_acquire();
+	bool result = !la_hash_seed_frozen;
+	if(result == true) {
+		la_hash_seed = seed;
+	}
+	la_hash_seed_lock_release();
+	return result;
+}
+
+uint32_t la_hash_seed_get(void) {
+	la_hash_seed_lock_acquire();
+	uint32_t seed = la_hash_seed;
+	la_hash_seed_lock_release();
+	return seed;
+}
+
+static inline uint64_t la_hash_mix_word(uint64_t h, uint64_t k) {
+	k *= LA_HASH_M;
+	k ^= k >> LA_HASH_R;
+	k *= LA_HASH_M;
+	h ^= k;
+	h *= LA_HASH_M;
+	return h;
+}
+
+// Computes the hash of len bytes pointed to by buf, taking h as the initial
+// value (either LA_HASH_INIT or a result of a previous call, when hashing
+// over several buffers).
+uint32_t la_hash_bytes(void const *buf, size_t len, uint32_t h) {
+	la_assert(buf != NULL || len == 0);
+	uint8_t const *p = buf;
+	uint64_t state = (((uint64_t)la_hash_seed << 32) | h) ^ ((uint64_t)len * LA_HASH_M);
+	uint64_t k;
+	for(; len >= sizeof(k); p += sizeof(k), len -= sizeof(k)) {
+		memcpy(&k, p, sizeof(k));
+		state = la_hash_mix_word(state, k);
+	}
+	if(len > 0) {
+		k = 0;
+		for(size_t i = 0; i < len; i++) {
+			k |= (uint64_t)p[i] << (8 * i);
+		}
+		state = la_hash_mix_word(state, k);
 	}
-	return (uint32_t)h_work;
+	state ^= state >> LA_HASH_R;
+	state *= LA_HASH_M;
+	state ^= state >> LA_HASH_R;
+	return (uint32_t)(state ^ (state >> 32));
+}
+
+uint32_t la_hash_string(char const *str, uint32_t h) {
+	la_assert(str != NULL);
+	return la_hash_bytes(str, strlen(str), h);
 }
 
 uint32_t la_hash_key_str(void const *k) {
@@ -66,51 +173,126 @@ bool la_hash_compare_keys_str(void const *key1, void const *key2) {
 la_hash *la_hash_new(la_hash_func *compute_hash, la_hash_compare_func *compare_keys,
 		la_hash_key_destroy_func *destroy_key, la_hash_value_destroy_func *destroy_value) {
 
-	LA_NEW(la_hash, h);
+	la_hash_seed_freeze();
+	LA_HEAP_NEW(la_hash, h);
 	h->compute_hash = (compute_hash ? compute_hash : la_hash_key_str);
 	h->compare_keys = (compare_keys ? compare_keys : la_hash_compare_keys_str);
 	h->destroy_key = destroy_key;        // no default; might be NULL
 	h->destroy_value = destroy_value;    // no default; might be NULL
+	h->size = LA_HASH_MIN_SIZE;
+	h->slots = LA_HEAP_XCALLOC(h->size, sizeof(la_hash_slot));
 	return h;
 }
 
-static size_t la_hash_get_bucket(la_hash const *h, void const *key) {
-	return h->compute_hash(key) % LA_HASH_SIZE;
+// Hash functions supplied by the user are not guaranteed to spread the values
+// evenly across low-order bits, which is what matters when the table size is a power of two. Mix the bits before
+// computing the slot index (this is the 32-bit finalizer from MurmurHash3).
+static inline uint32_t la_hash_mix(uint32_t h) {
+	h ^= h >> 16;
+	h *= 0x85ebca6bU;
+	h ^= h >> 13;
+	h *= 0xc2b2ae35U;
+	h ^= h >> 16;
+	return h;
 }
 
-static la_list *la_hash_lookup_list_node(la_hash const *h, void const *key,
-		la_list **prev_node) {
-	la_assert(h != NULL);
-	la_assert(key != NULL);
+static inline size_t la_hash_home_slot(la_hash const *h, uint32_t hash) {
+	return la_hash_mix(hash) & (h->size - 1);
+}
 
-	size_t bucket = la_hash_get_bucket(h, key);
-	la_list *l = h->buckets[bucket];
-	la_list *pl = NULL;
-	la_hash_element *elem;
-	for(; l != NULL; pl = l, l = la_list_next(l)) {
-		elem = l->data;
-		if(h->compare_keys(key, elem->key) == true) {
-			break;
+// Returns the index of the slot containing the given key
+// or -1 if the key is not present in the hash.
+static ptrdiff_t la_hash_find_slot(la_hash const *h, void const *key, uint32_t hash) {
+	size_t mask = h->size - 1;
+	for(size_t i = la_hash_home_slot(h, hash); h->slots[i].key != NULL; i = (i + 1) & mask) {
+		la_hash_slot const *slot = h->slots + i;
+		if(slot->hash == hash && h->compare_keys(key, slot->key) == true) {
+			return (ptrdiff_t)i;
+		}
+	}
+	return -1;
+}
+
+// Stores the key/value pair in the first free slot of its probe sequence.
+// The key must not be present in the hash.
+static void la_hash_slot_put(la_hash *h, void *key, void *value, uint32_t hash) {
+	size_t mask = h->size - 1;
+	size_t i = la_hash_home_slot(h, hash);
+	while(h->slots[i].key != NULL) {
+		i = (i + 1) & mask;
+	}
+	h->slots[i] = (la_hash_slot){ .key = key, .value = value, .hash = hash };
+	h->count++;
+}
+
+static void la_hash_resize(la_hash *h, size_t new_size) {
+	la_assert(new_size >= LA_HASH_MIN_SIZE);
+	la_assert(LA_HASH_GROW_THRESHOLD(new_size) > h->count);
+
+	la_hash_slot *old_slots = h->slots;
+	size_t old_size = h->size;
+	h->slots = LA_HEAP_XCALLOC(new_size, sizeof(la_hash_slot));
+	h->size = new_size;
+	h->count = 0;
+	for(size_t i = 0; i < old_size; i++) {
+		if(old_slots[i].key != NULL) {
+			la_hash_slot_put(h, old_slots[i].key, old_slots[i].value, old_slots[i].hash);
 		}
 	}
-	// Give back pointer to the previous node if the caller wants it
-	if(prev_node != NULL) {
-		*prev_node = pl;
+	LA_XFREE(old_slots);
+}
+
+static void la_hash_shrink_if_needed(la_hash *h) {
+	size_t new_size = h->size;
+	while(new_size > LA_HASH_MIN_SIZE && h->count < LA_HASH_SHRINK_THRESHOLD(new_size)) {
+		new_size /= 2;
+	}
+	if(new_size != h->size) {
+		la_hash_resize(h, new_size);
 	}
-	// Return the node containing the requested key (or NULL if not found)
-	return l;
+}
+
+// Empties the slot at index i and moves subsequent entries of the same
+// cluster backwards, so that there are no holes in their probe sequences.
+static void la_hash_slot_clear(la_hash *h, size_t i) {
+	size_t mask = h->size - 1;
+	size_t j = i;
+	for(;;) {
+		j = (j + 1) & mask;
+		if(h->slots[j].key == NULL) {
+			break;
+		}
+		// Move the entry from slot j to the hole at i, unless its home slot
+		// lies cyclically in (i, j], in which case it must stay where it is.
+		size_t home = la_hash_home_slot(h, h->slots[j].hash);
+		if(i <= j ? (i < home && home <= j) : (i < home || home <= j)) {
+			continue;
+		}
+		h->slots[i] = h->slots[j];
+		i = j;
+	}
+	h->slots[i] = (la_hash_slot){ .key = NULL, .value = NULL, .hash = 0 };
+	h->count--;
 }
 
 void *la_hash_lookup(la_hash const *h, void const *key) {
 	la_assert(h != NULL);
 	la_assert(key != NULL);
 
-	la_list *list_node = la_hash_lookup_list_node(h, key, NULL);
-	if(list_node == NULL) {
+	return la_hash_lookup_with_hash(h, key, h->compute_hash(key));
+}
+
+// Same as la_hash_lookup(), but uses a hash value precomputed by the caller.
+// The value must be equal to what compute_hash() would return for this key.
+void *la_hash_lookup_with_hash(la_hash const *h, void const *key, uint32_t hash) {
+	la_assert(h != NULL);
+	la_assert(key != NULL);
+
+	ptrdiff_t i = la_hash_find_slot(h, key, hash);
+	if(i < 0) {
 		return NULL;
 	}
-	la_hash_element *elem = list_node->data;
-	return (void *)elem->value;
+	return h->slots[i].value;
 }
 
 // Inserts the new key into the hash and assigns it a value.  Key and value
@@ -123,22 +305,30 @@ bool la_hash_insert(la_hash *h, void *key, void *value) {
 	la_assert(h != NULL);
 	la_assert(key != NULL);
 
-	la_list *list_node = la_hash_lookup_list_node(h, key, NULL);
-	if(list_node != NULL) {
+	return la_hash_insert_with_hash(h, key, value, h->compute_hash(key));
+}
+
+// Same as la_hash_insert(), but uses a hash value precomputed by the caller.
+// The value must be equal to what compute_hash() would return for this key.
+bool la_hash_insert_with_hash(la_hash *h, void *key, void *value, uint32_t hash) {
+	la_assert(h != NULL);
+	la_assert(key != NULL);
+
+	ptrdiff_t i = la_hash_find_slot(h, key, hash);
+	if(i >= 0) {
 		// Key already exists - insert the new value, free the old value,
 		// preserve the old key, free the new key
-		la_hash_element *elem = list_node->data;
+		la_hash_slot *slot = h->slots + i;
 		la_hash_destroy_key(h, key);
-		la_hash_destroy_value(h, elem->value);
-		elem->value = value;
+		la_hash_destroy_value(h, slot->value);
+		slot->value = value;
 		return true;
 	}
 	// Key not found - create new hash entry
-	LA_NEW(la_hash_element, elem);
-	elem->key = key;
-	elem->value = value;
-	size_t bucket = la_hash_get_bucket(h, key);
-	h->buckets[bucket] = la_list_append(h->buckets[bucket], elem);
+	if(h->count + 1 > LA_HASH_GROW_THRESHOLD(h->size)) {
+		la_hash_resize(h, h->size * 2);
+	}
+	la_hash_slot_put(h, key, value, hash);
 	return false;
 }
 
@@ -149,82 +339,82 @@ bool la_hash_remove(la_hash *h, void *key) {
 	la_assert(h != NULL);
 	la_assert(key != NULL);
 
-	la_list *prev_node = NULL;
-	la_list *list_node = la_hash_lookup_list_node(h, key, &prev_node);
-	if(list_node == NULL) {
+	return la_hash_remove_with_hash(h, key, h->compute_hash(key));
+}
+
+// Same as la_hash_remove(), but uses a hash value precomputed by the caller.
+// The value must be equal to what compute_hash() would return for this key.
+bool la_hash_remove_with_hash(la_hash *h, void *key, uint32_t hash) {
+	la_assert(h != NULL);
+	la_assert(key != NULL);
+
+	ptrdiff_t i = la_hash_find_slot(h, key, hash);
+	if(i < 0) {
 		return false;
 	}
-	// If prev_node is not NULL, then join two list parts together.
-	// Otherwise replace the top of the list in the bucket.
-	if(prev_node != NULL) {
-		prev_node->next = list_node->next;
-	} else {
-		size_t bucket = la_hash_get_bucket(h, key);
-		h->buckets[bucket] = list_node->next;
-	}
-	list_node->next = NULL;
-	// Now free the key and value
-	la_hash_element *elem = list_node->data;
-	la_hash_destroy_key(h, elem->key);
-	la_hash_destroy_value(h, elem->value);
-	// This will free elem too
-	// XXX: use la_hash_element_destroy instead?
-	la_list_free(list_node);
+	// The key given as argument might be the one stored in the hash,
+	// so don't touch it after destroying the slot contents.
+	la_hash_slot slot = h->slots[i];
+	la_hash_slot_clear(h, (size_t)i);
+	la_hash_destroy_key(h, slot.key);
+	la_hash_destroy_value(h, slot.value);
+	la_hash_shrink_if_needed(h);
 	return true;
 }
 
-static void la_free_noop(void *data) {
-	LA_UNUSED(data);
-	// noop
-}
-
 // Iterates over hash entries executing la_hash_if_func() for each key-value
 // pair. If the func returns true, removes the entry from the hash.
 int la_hash_foreach_remove(la_hash *h, la_hash_if_func *if_func, void *if_func_ctx) {
 	la_assert(h != NULL);
 	la_assert(if_func != NULL);
 
-	la_list *keys_to_delete = NULL;
+	if(h->count == 0) {
+		return 0;
+	}
+	// Start the walk right after an empty slot. Backward shifts never move
+	// entries across an empty slot, so an entry may only be moved from a slot
+	// which has not been visited yet into the current one. Hence every entry
+	// is visited exactly once.
+	size_t mask = h->size - 1;
+	size_t start = 0;
+	while(h->slots[start].key != NULL) {
+		start++;
+	}
 	int num_keys_deleted = 0;
-	for(size_t i = 0; i < LA_HASH_SIZE; i++) {
-		for(la_list *l = h->buckets[i]; l != NULL; l = la_list_next(l)) {
-			la_hash_element *elem = l->data;
-			if(if_func(elem->key, elem->value, if_func_ctx) == true) {
-				keys_to_delete = la_list_append(keys_to_delete, elem->key);
-				num_keys_deleted++;
+	size_t i = (start + 1) & mask;
+	for(size_t visited = 0; visited < h->size; ) {
+		la_hash_slot slot = h->slots[i];
+		if(slot.key != NULL && if_func(slot.key, slot.value, if_func_ctx) == true) {
+			la_hash_slot_clear(h, i);
+			la_hash_destroy_key(h, slot.key);
+			la_hash_destroy_value(h, slot.value);
+			num_keys_deleted++;
+			// Another entry might have been shifted into this slot.
+			// Examine it again without advancing.
+			if(h->slots[i].key != NULL) {
+				continue;
 			}
 		}
+		i = (i + 1) & mask;
+		visited++;
 	}
-	for(la_list *l = keys_to_delete; l != NULL; l = la_list_next(l)) {
-		la_hash_remove(h, l->data);
-	}
-	// can't use la_list_free() here, as keys have already been freed by la_hash_remove()
-	la_list_free_full(keys_to_delete, la_free_noop);
+	la_hash_shrink_if_needed(h);
 	return num_keys_deleted;
 }
 
-// This is a callback for la_list_free_full_with_ctx()
-static void la_hash_element_destroy(void *elemptr, void *hashptr) {
-	la_assert(hashptr != NULL);
-	if(elemptr == NULL) {
-		return;
-	}
-	la_hash *h = hashptr;
-	la_hash_element *elem = elemptr;
-	la_hash_destroy_key(h, elem->key);
-	la_hash_destroy_value(h, elem->value);
-	LA_XFREE(elem);
-}
-
 // Deallocates all keys and values (if destroy functions have been provided)
 // and then frees the memory used by the hash.
 void la_hash_destroy(la_hash *h) {
 	if(h == NULL) {
 		return;
 	}
-	for(size_t i = 0; i < LA_HASH_SIZE; i++) {
-		la_list_free_full_with_ctx(h->buckets[i], la_hash_element_destroy, h);
-		h->buckets[i] = NULL;
+	for(size_t i = 0; i < h->size; i++) {
+		la_hash_slot *slot = h->slots + i;
+		if(slot->key != NULL) {
+			la_hash_destroy_key(h, slot->key);
+			la_hash_destroy_value(h, slot->value);
+		}
 	}
+	LA_XFREE(h->slots);
 	LA_XFREE(h);
 }
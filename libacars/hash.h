@@ -7,6 +7,7 @@
 #define LA_HASH_H 1
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #ifdef __cplusplus
@@ -21,15 +22,21 @@ typedef void (la_hash_key_destroy_func)(void *key);
 typedef void (la_hash_value_destroy_func)(void *value);
 
 #define LA_HASH_INIT 5381
-#define LA_HASH_MULTIPLIER 17
+#define LA_HASH_MULTIPLIER 17          /* not used anymore, kept for compatibility */
 
 la_hash *la_hash_new(la_hash_func *compute_hash, la_hash_compare_func *compare_keys,
 		la_hash_key_destroy_func *destroy_key, la_hash_value_destroy_func *destroy_value);
 bool la_hash_insert(la_hash *h, void *key, void *value);
+bool la_hash_insert_with_hash(la_hash *h, void *key, void *value, uint32_t hash);
 bool la_hash_remove(la_hash *h, void *key);
+bool la_hash_remove_with_hash(la_hash *h, void *key, uint32_t hash);
 void *la_hash_lookup(la_hash const *h, void const *key);
+void *la_hash_lookup_with_hash(la_hash const *h, void const *key, uint32_t hash);
 uint32_t la_hash_key_str(void const *k);
 uint32_t la_hash_string(char const *str, uint32_t h);
+uint32_t la_hash_bytes(void const *buf, size_t len, uint32_t h);
+bool la_hash_seed_set(uint32_t seed);
+uint32_t la_hash_seed_get(void);
 bool la_hash_compare_keys_str(void const *key1, void const *key2);
 void la_simple_free(void *data);
 int la_hash_foreach_remove(la_hash *h, la_hash_if_func *if_func, void *if_func_ctx);
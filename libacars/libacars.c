@@ -11,7 +11,7 @@
 #include <libacars/libacars.h>      // la_proto_node
 #include <libacars/vstring.h>
 #include <libacars/json.h>
-#include <libacars/util.h>          // LA_XCALLOC, LA_XFREE
+#include <libacars/util.h>          // LA_XCALLOC, LA_XFREE, LA_ALLOC_MODULE_ENTER
 
 static void la_proto_node_format_text(la_vstring *vstr, la_proto_node const *node, int indent) {
 	la_assert(indent >= 0);
@@ -52,22 +52,26 @@ la_proto_node *la_proto_node_new() {
 la_vstring *la_proto_tree_format_text(la_vstring *vstr, la_proto_node const *root) {
 	la_assert(root);
 
+	LA_ALLOC_MODULE_ENTER(LA_ALLOC_MODULE_FORMATTERS);
 	if(vstr == NULL) {
 		vstr = la_vstring_new();
 	}
 	la_proto_node_format_text(vstr, root, 0);
+	LA_ALLOC_MODULE_LEAVE();
 	return vstr;
 }
 
 la_vstring *la_proto_tree_format_json(la_vstring *vstr, la_proto_node const *root) {
 	la_assert(root);
 
+	LA_ALLOC_MODULE_ENTER(LA_ALLOC_MODULE_FORMATTERS);
 	if(vstr == NULL) {
 		vstr = la_vstring_new();
 	}
 	la_json_start(vstr);
 	la_proto_node_format_json(vstr, root);
 	la_json_end(vstr);
+	LA_ALLOC_MODULE_LEAVE();
 	return vstr;
 }
 
@@ -98,6 +102,8 @@ la_proto_node *la_proto_tree_find_protocol(la_proto_node *root, la_type_descript
 
 #ifdef DEBUG
 
+// Set by la_debug_init() before main() starts and never modified afterwards,
+// so it may be read by any thread without synchronization.
 uint32_t Debug = 0;
 
 void __attribute__ ((constructor)) la_debug_init() {
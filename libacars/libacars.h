@@ -7,6 +7,8 @@
 #ifndef LA_LIBACARS_H
 #define LA_LIBACARS_H 1
 #include <stdbool.h>
+#include <stddef.h>                 // size_t
+#include <stdint.h>
 #include <libacars/version.h>
 #include <libacars/vstring.h>       // la_vstring
 
@@ -20,6 +22,82 @@ typedef enum {
 	LA_MSG_DIR_AIR2GND
 } la_msg_dir;
 
+// Called when an allocation of size bytes has failed. Returns true if the
+// allocation shall be retried (eg. because the callee has released some
+// memory). If it returns false, the program is aborted.
+typedef bool (la_alloc_failure_func)(size_t size, void *ctx);
+
+typedef struct {
+	void *(*calloc_cb)(size_t nmemb, size_t size, void *ctx);
+	void *(*realloc_cb)(void *ptr, size_t size, void *ctx);
+	void (*free_cb)(void *ptr, void *ctx);
+	char *(*strdup_cb)(char const *s, void *ctx);   /* optional */
+	la_alloc_failure_func *failure_cb;              /* optional */
+	void *ctx;                                      /* passed to all callbacks */
+// reserved for future use
+	void (*reserved0)(void);
+	void (*reserved1)(void);
+	void (*reserved2)(void);
+	void (*reserved3)(void);
+} la_allocator;
+
+// Decoder settings. Their meaning is the same as of configuration
+// parameters with the same names (see config_defaults.h).
+typedef struct {
+	bool dump_asn1;
+	bool decode_fragments;
+	long int acars_bearer;
+	bool acars_adaptive_timeouts;
+	bool prettify_xml;
+	bool prettify_json;
+// reserved for future use
+	void (*reserved0)(void);
+	void (*reserved1)(void);
+	void (*reserved2)(void);
+	void (*reserved3)(void);
+	void (*reserved4)(void);
+	void (*reserved5)(void);
+	void (*reserved6)(void);
+	void (*reserved7)(void);
+} la_decoder_config;
+
+// Modules to which memory allocations are attributed, when the library
+// is built with ALLOC_STATS option.
+typedef enum {
+	LA_ALLOC_MODULE_OTHER,
+	LA_ALLOC_MODULE_ACARS,
+	LA_ALLOC_MODULE_ARINC,
+	LA_ALLOC_MODULE_CPDLC,
+	LA_ALLOC_MODULE_ADSC,
+	LA_ALLOC_MODULE_MIAM,
+	LA_ALLOC_MODULE_MIAM_CORE,
+	LA_ALLOC_MODULE_OHMA,
+	LA_ALLOC_MODULE_MEDIA_ADV,
+	LA_ALLOC_MODULE_REASSEMBLY,
+	LA_ALLOC_MODULE_FORMATTERS
+} la_alloc_module;
+#define LA_ALLOC_MODULE_MAX LA_ALLOC_MODULE_FORMATTERS
+
+typedef struct {
+	uint64_t allocs;                /* allocations (calloc, strdup) */
+
+	uint64_t reallocs;              /* reallocations */
+
+	uint64_t frees;                 /* frees of non-NULL pointers */
+
+	uint64_t bytes;                 /* bytes requested by allocations
+	                                   and reallocations */
+
+	uint64_t heap_allocs;           /* allocations and reallocations passed to
+	                                   the heap allocator (ie. not served by
+	                                   an arena) */
+// reserved for future use
+	void (*reserved0)(void);
+	void (*reserved1)(void);
+	void (*reserved2)(void);
+	void (*reserved3)(void);
+} la_alloc_stats;
+
 typedef void (la_format_text_func)(la_vstring *vstr, void const *data, int indent);
 typedef void (la_format_json_func)(la_vstring *vstr, void const *data);
 typedef void (la_destroy_type_f)(void *data);
@@ -72,6 +150,15 @@ bool la_config_get_int(char const *name, long int *result);
 bool la_config_get_double(char const *name, double *result);
 bool la_config_get_str(char const *name, char **result);
 bool la_config_unset(char *name);
+void la_decoder_config_init(la_decoder_config *config);
+la_decoder_config const *la_decoder_config_set(la_decoder_config const *config);
+la_decoder_config const *la_decoder_config_get();
+
+// util.c
+void la_set_allocator(la_allocator const *allocator);
+bool la_alloc_stats_get(la_alloc_module module, la_alloc_stats *result);
+void la_alloc_stats_reset();
+char const *la_alloc_module_name_get(la_alloc_module module);
 
 // configuration.c
 
@@ -29,18 +29,33 @@ la_list *la_list_append(la_list *l, void *data) {
 	}
 }
 
+// Appends a new element to the list l in constant time.
+// *tail must point to the last element of the list. If it's NULL, the list
+// is walked to find the last element. Upon return *tail points to the newly
+// appended element, so that it might be passed to subsequent calls.
+// Returns a pointer to the list head (which might be a new list if l == NULL).
+la_list *la_list_append_with_tail(la_list *l, la_list **tail, void *data) {
+	la_assert(tail != NULL);
+	la_assert(*tail == NULL || (*tail)->next == NULL);
+	if(l != NULL && *tail == NULL) {
+		for(*tail = l; (*tail)->next != NULL; *tail = la_list_next(*tail))
+			;
+	}
+	*tail = la_list_insert(*tail, data);
+	return l != NULL ? l : *tail;
+}
+
 // Inserts a new element at position l->next.
 // Returns a pointer to the newly inserted element
 // (which might be a new list if l == NULL).
 la_list *la_list_insert(la_list *l, void *data) {
-	if(l == NULL) {
-		return la_list_append(l, data);
+	LA_NEW(la_list, new);
+	new->data = data;
+	if(l != NULL) {
+		new->next = l->next;
+		l->next = new;
 	}
-	la_list *next = l->next;
-	l->next = NULL;
-	l = la_list_append(l, data);
-	l->next->next = next;
-	return l->next;
+	return new;
 }
 
 // Prepends a new element to the list l.
@@ -64,13 +79,14 @@ la_list *la_list_insert_sorted(la_list *list, void *data, la_list_compare_func *
 	if(compare_nodes(list->data, data) > 0) {
 		return la_list_prepend(list, data);
 	}
-	for(la_list *l = list; l->next != NULL; l = la_list_next(l)) {
+	la_list *l = list;
+	for(; l->next != NULL; l = la_list_next(l)) {
 		if(compare_nodes(l->next->data, data) > 0) {
-			(void)la_list_insert(l, data);
-			return list;
+			break;
 		}
 	}
-	return la_list_append(list, data);
+	(void)la_list_insert(l, data);
+	return list;
 }
 
 size_t la_list_length(la_list const *l) {
@@ -87,32 +103,32 @@ void la_list_foreach(la_list *l, void (*cb)(), void *ctx) {
 	}
 }
 
+// Lists are freed iteratively (rather than recursively), so that
+// long lists do not exhaust the stack.
 void la_list_free_full_with_ctx(la_list *l, void (*node_free)(), void *ctx) {
-	if(l == NULL) {
-		return;
-	}
-	la_list_free_full_with_ctx(l->next, node_free, ctx);
-	l->next = NULL;
-	if(node_free != NULL) {
-		node_free(l->data, ctx);
-	} else {
-		LA_XFREE(l->data);
+	la_list *next = NULL;
+	for(; l != NULL; l = next) {
+		next = l->next;
+		if(node_free != NULL) {
+			node_free(l->data, ctx);
+		} else {
+			LA_XFREE(l->data);
+		}
+		LA_XFREE(l);
 	}
-	LA_XFREE(l);
 }
 
 void la_list_free_full(la_list *l, void (*node_free)()) {
-	if(l == NULL) {
-		return;
-	}
-	la_list_free_full(l->next, node_free);
-	l->next = NULL;
-	if(node_free != NULL) {
-		node_free(l->data);
-	} else {
-		LA_XFREE(l->data);
+	la_list *next = NULL;
+	for(; l != NULL; l = next) {
+		next = l->next;
+		if(node_free != NULL) {
+			node_free(l->data);
+		} else {
+			LA_XFREE(l->data);
+		}
+		LA_XFREE(l);
 	}
-	LA_XFREE(l);
 }
 
 void la_list_free(la_list *l) {
@@ -23,6 +23,7 @@ typedef int (la_list_compare_func)(void const *data1, void const *data2);
 
 la_list *la_list_next(la_list const *l);
 la_list *la_list_append(la_list *l, void *data);
+la_list *la_list_append_with_tail(la_list *l, la_list **tail, void *data);
 la_list *la_list_prepend(la_list *l, void *data);
 la_list *la_list_insert(la_list *l, void *data);
 la_list *la_list_insert_sorted(la_list *list, void *data, la_list_compare_func *compare_nodes);
@@ -83,4 +83,10 @@ extern uint32_t Debug;
 #define LA_NEW(type, x) type *(x) = LA_XCALLOC(1, sizeof(type))
 #define LA_UNUSED(x) (void)(x)
 
+#if defined(_MSC_VER)
+#define LA_THREAD_LOCAL __declspec(thread)
+#else
+#define LA_THREAD_LOCAL _Thread_local
+#endif
+
 #endif // !LA_MACROS_H
@@ -12,7 +12,7 @@
 #include <libacars/macros.h>        // la_assert()
 #include <libacars/vstring.h>       // la_vstring, la_vstring_append_sprintf(), LA_ISPRINTF()
 #include <libacars/json.h>          // la_json_*()
-#include <libacars/util.h>          // LA_XCALLOC(), ATOI2()
+#include <libacars/util.h>          // LA_XCALLOC(), LA_XSTRDUP(), ATOI2()
 
 typedef struct {
 	char code;
@@ -48,6 +48,7 @@ la_proto_node *la_media_adv_parse(char const *txt) {
 		return NULL;
 	}
 
+	LA_ALLOC_MODULE_ENTER(LA_ALLOC_MODULE_MEDIA_ADV);
 	LA_NEW(la_media_adv_msg, msg);
 	msg->err = true;
 
@@ -93,10 +94,11 @@ la_proto_node *la_media_adv_parse(char const *txt) {
 		}
 	}
 	if(txt[0] == '/' && txt[1] != '\0') {
-		msg->text = strdup(txt + 1);
+		msg->text = LA_XSTRDUP(txt + 1);
 	}
 	msg->err = false;
 end:
+	LA_ALLOC_MODULE_LEAVE();
 	return node;
 }
 
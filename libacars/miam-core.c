@@ -12,7 +12,7 @@
 #include <libxml/tree.h>            // xmlBufferPtr, xmlBufferFree()
 #endif
 #include <libacars/macros.h>        // la_assert(), LA_UNLIKELY()
-#include <libacars/libacars.h>      // la_proto_node
+#include <libacars/libacars.h>      // la_proto_node, la_decoder_config_get
 #include <libacars/vstring.h>       // la_vstring, LA_ISPRINTF, la_isprintf_multiline_text()
 #include <libacars/json.h>          // la_json_append_*()
 #include <libacars/dict.h>          // la_dict, la_dict_search()
@@ -186,7 +186,7 @@ static la_proto_node *la_miam_core_v1v2_alr_parse(uint8_t const *hdrbuf, int hdr
 	return v1v2_alo_alr_parse(hdrbuf, hdrlen, bodybuf, bodylen, LA_MIAM_CORE_PDU_ALR);
 }
 
-la_proto_node *la_miam_core_pdu_parse(char const *txt) {
+static la_proto_node *la_miam_core_pdu_parse_internal(char const *txt) {
 	la_assert(txt != NULL);
 
 	// Determine if it's a MIAM CORE PDU - check body/header padding counts and look for header/body delimiter
@@ -289,6 +289,13 @@ end:
 	return node;
 }
 
+la_proto_node *la_miam_core_pdu_parse(char const *txt) {
+	LA_ALLOC_MODULE_ENTER(LA_ALLOC_MODULE_MIAM_CORE);
+	la_proto_node *node = la_miam_core_pdu_parse_internal(txt);
+	LA_ALLOC_MODULE_LEAVE();
+	return node;
+}
+
 // MIAM CORE v1/v2 common formatters
 
 static void la_miam_errors_format_text(la_vstring *vstr, uint32_t err, int indent) {
@@ -741,7 +748,7 @@ static void la_miam_core_v1_data_format_text(la_vstring *vstr, void const *data,
 			// Parser has appended '\0' at the end, so it's safe to print it directly
 			bool prettify_xml = false;
 #ifdef WITH_LIBXML2
-			(void)la_config_get_bool("prettify_xml", &prettify_xml);
+			prettify_xml = la_decoder_config_get()->prettify_xml;
 			if(prettify_xml == true) {
 				xmlBufferPtr xmlbufptr = NULL;
 				if((xmlbufptr = la_prettify_xml((char *)pdu->data)) != NULL) {
@@ -1142,7 +1149,7 @@ static void la_miam_core_v2_data_format_text(la_vstring *vstr, void const *data,
 			// Parser has appended '\0' at the end, so it's safe to print it directly
 			bool prettify_xml = false;
 #ifdef WITH_LIBXML2
-			(void)la_config_get_bool("prettify_xml", &prettify_xml);
+			prettify_xml = la_decoder_config_get()->prettify_xml;
 			if(prettify_xml == true) {
 				xmlBufferPtr xmlbufptr = NULL;
 				if((xmlbufptr = la_prettify_xml((char *)pdu->data)) != NULL) {
@@ -8,15 +8,15 @@
 #include <stdint.h>
 #include <stdbool.h>
 #include <stdlib.h>                 /* calloc() */
-#include <string.h>                 /* strchr(), strlen(), strncmp(), strcmp() */
+#include <string.h>                 /* strchr(), strlen(), strncmp(), strcmp(), memcpy() */
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>               /* struct timeval */
 #endif
 #include <libacars/macros.h>        /* la_assert() */
-#include <libacars/libacars.h>      /* la_proto_node, la_type_descriptor */
+#include <libacars/libacars.h>      /* la_proto_node, la_type_descriptor, la_decoder_config_get */
 #include <libacars/vstring.h>       /* la_vstring */
 #include <libacars/json.h>          /* la_json_append_*() */
-#include <libacars/util.h>          /* la_strntouint16_t(), la_simple_strptime() */
+#include <libacars/util.h>          /* la_strntouint16_t(), la_simple_strptime(), la_hash_words() */
 #include <libacars/dict.h>          /* la_dict, la_dict_search() */
 #include <libacars/reassembly.h>
 #include <libacars/miam-core.h>     /* la_miam_core_pdu_parse(), la_miam_core_format_*() */
@@ -64,41 +64,41 @@ static struct timeval const la_miam_file_reasm_timeout = {
 	.tv_usec = 0
 };
 
-typedef struct {
-	char *reg;
-	uint16_t file_id;
+// Reassembly key of a file transfer. The registration number is stored as
+// a zero-padded fixed-width field, so that the key can be hashed and compared
+// as two 64-bit words. Longer registration numbers are truncated (ACARS ones
+// are at most 7 characters long).
+typedef union {
+	struct {
+		char reg[14];
+		uint16_t file_id;
+	} f;
+	uint64_t w[2];
 } la_miam_file_key;
 
+static void la_miam_file_key_fill(la_miam_file_key *key, char const *reg, uint16_t file_id) {
+	key->w[0] = key->w[1] = 0;
+	la_strpad(key->f.reg, reg, sizeof(key->f.reg));
+	key->f.file_id = file_id;
+}
+
 static uint32_t la_miam_file_key_hash(void const *key) {
 	la_miam_file_key const *k = key;
-	uint32_t h = la_hash_string(k->reg, LA_HASH_INIT);
-	h += k->file_id;
-	return h;
+	return la_hash_words(k->w, 2);
 }
 
 static bool la_miam_file_key_compare(void const *key1, void const *key2) {
 	la_miam_file_key const *k1 = key1;
 	la_miam_file_key const *k2 = key2;
-	return (!strcmp(k1->reg, k2->reg) &&
-			(k1->file_id == k2->file_id));
+	return k1->w[0] == k2->w[0] && k1->w[1] == k2->w[1];
 }
 
+// msg_info passed to the reassembly engine is the key itself
 static void *la_miam_file_key_get(void const *msg_info) {
 	la_assert(msg_info != NULL);
-	la_miam_file_key const *msg = msg_info;
-	LA_NEW(la_miam_file_key, key);
-	key->reg = strdup(msg->reg);
-	key->file_id = msg->file_id;
-	la_debug_print(D_INFO, "ALLOC KEY %s %d\n", key->reg, key->file_id);
-	return (void *)key;
-}
-
-static void *la_miam_file_tmp_key_get(void const *msg_info) {
-	la_assert(msg_info != NULL);
-	la_miam_file_key const *msg = msg_info;
-	LA_NEW(la_miam_file_key, key);
-	key->reg = (char *)msg->reg;
-	key->file_id = msg->file_id;
+	LA_HEAP_NEW(la_miam_file_key, key);
+	*key = *(la_miam_file_key const *)msg_info;
+	la_debug_print(D_INFO, "ALLOC KEY %.14s %d\n", key->f.reg, key->f.file_id);
 	return (void *)key;
 }
 
@@ -107,19 +107,42 @@ static void la_miam_file_key_destroy(void *ptr) {
 		return;
 	}
 	la_miam_file_key *key = ptr;
-	la_debug_print(D_INFO, "DESTROY KEY %s %d\n", key->reg, key->file_id);
-	LA_XFREE(key->reg);
+	la_debug_print(D_INFO, "DESTROY KEY %.14s %d\n", key->f.reg, key->f.file_id);
 	LA_XFREE(key);
 }
 
+static size_t la_miam_file_key_serialize(void const *key, uint8_t *buf, size_t buflen) {
+	la_miam_file_key const *k = key;
+	if(buflen >= sizeof(k->f)) {
+		memcpy(buf, &k->f, sizeof(k->f));
+	}
+	return sizeof(k->f);
+}
+
+static void *la_miam_file_key_deserialize(uint8_t const *buf, size_t len) {
+	LA_HEAP_NEW(la_miam_file_key, key);
+	if(len != sizeof(key->f)) {
+		LA_XFREE(key);
+		return NULL;
+	}
+	memcpy(&key->f, buf, len);
+	return (void *)key;
+}
+
 static la_reasm_table_funcs miam_file_reasm_funcs = {
 	.get_key = la_miam_file_key_get,
-	.get_tmp_key = la_miam_file_tmp_key_get,
+	.get_tmp_key = la_miam_file_key_get,
 	.hash_key = la_miam_file_key_hash,
 	.compare_keys = la_miam_file_key_compare,
 	.destroy_key = la_miam_file_key_destroy
 };
 
+static la_reasm_key_codec const miam_file_reasm_key_codec = {
+	.name = "miam_file",
+	.serialize_key = la_miam_file_key_serialize,
+	.deserialize_key = la_miam_file_key_deserialize
+};
+
 /********************************************************************************
  * MIAM frame parsers
  ********************************************************************************/
@@ -181,17 +204,23 @@ static la_proto_node *la_miam_file_transfer_request_parse(char const *reg, char
 			miam_file_table = la_reasm_table_new(rtables,
 					&la_DEF_miam_file_segment_message, miam_file_reasm_funcs,
 					LA_MIAM_FILE_REASM_TABLE_CLEANUP_INTERVAL);
+			la_reasm_table_key_codec_set(miam_file_table, &miam_file_reasm_key_codec);
 		}
 		// Add the initial empty fragment to the table.
 		// Can't use msg as msg_info directly, because we will be adding subsequent
 		// fragments from la_miam_file_segment_parse(), where the type of msg is
 		// different.
+		la_miam_file_key msg_key;
+		la_miam_file_key_fill(&msg_key, reg, msg->file_id);
+		// A request reusing the file_id of a transfer which is still being
+		// reassembled, but announcing a different file size, starts a new
+		// transfer. Drop the old one, otherwise the segments of the new file
+		// would be taken as duplicates. A retransmission of the same request
+		// is reported as a duplicate.
 		msg->reasm_status = la_reasm_fragment_add(miam_file_table,
 				&(la_reasm_fragment_info){
-					.msg_info = &(la_miam_file_key){
-						.reg = (char *)reg,
-						.file_id = msg->file_id
-					},
+					.msg_info = &msg_key,
+					.tmp_key = &msg_key,
 					.msg_data = NULL,       // payload will start in the next segment
 					.msg_data_len = 0,
 					.total_pdu_len = msg->file_size,
@@ -201,7 +230,8 @@ static la_proto_node *la_miam_file_transfer_request_parse(char const *reg, char
 					.seq_num_wrap = SEQ_WRAP_NONE,
 					.is_final_fragment = false,
 					.rx_time = rx_time,
-					.reasm_timeout = la_miam_file_reasm_timeout
+					.reasm_timeout = la_miam_file_reasm_timeout,
+					.flags = LA_REASM_RESTART_IF_CHANGED
 				});
 	}
 	return node;
@@ -290,23 +320,25 @@ static la_proto_node *la_miam_file_segment_parse(char const *reg, char const *tx
 	// Can't use msg as msg_info directly in la_reasm_fragment_info, because the
 	// initial fragment is added by la_miam_file_transfer_request_parse(), where
 	// the type of msg is different.
-	la_miam_file_key msg_key = {
-		.reg = (char *)reg,
-		.file_id = msg->file_id
-	};
+	la_miam_file_key msg_key;
 	la_reasm_table *miam_file_table = NULL;
+	uint8_t *reassembled_msg = NULL;
+	int reasm_len = -1;
 
 	if(rtables != NULL && reg != NULL) {
+		la_miam_file_key_fill(&msg_key, reg, msg->file_id);
 		miam_file_table = la_reasm_table_lookup(rtables, &la_DEF_miam_file_segment_message);
 		if(miam_file_table == NULL) {
 			miam_file_table = la_reasm_table_new(rtables,
 					&la_DEF_miam_file_segment_message, miam_file_reasm_funcs,
 					LA_MIAM_FILE_REASM_TABLE_CLEANUP_INTERVAL);
+			la_reasm_table_key_codec_set(miam_file_table, &miam_file_reasm_key_codec);
 		}
 		// Add the fragment to the table.
-		msg->reasm_status = la_reasm_fragment_add(miam_file_table,
+		msg->reasm_status = la_reasm_fragment_add_and_reassemble(miam_file_table,
 				&(la_reasm_fragment_info){
 					.msg_info = &msg_key,
+					.tmp_key = &msg_key,
 					.msg_data = (uint8_t *)txt,
 					.msg_data_len = strlen(txt),
 					.total_pdu_len = 0,         // already set in 1st fragment
@@ -317,12 +349,10 @@ static la_proto_node *la_miam_file_segment_parse(char const *reg, char const *tx
 					.is_final_fragment = false, // not used here
 					.rx_time = rx_time,
 					.reasm_timeout = la_miam_file_reasm_timeout
-				});
+				}, &reassembled_msg, &reasm_len);
 	}
 
-	uint8_t *reassembled_msg = NULL;
-	if(msg->reasm_status == LA_REASM_COMPLETE &&
-			la_reasm_payload_get(miam_file_table, &msg_key, &reassembled_msg) > 0) {
+	if(reasm_len > 0) {
 		// reassembled_msg is a newly allocated byte buffer, which is guaranteed to
 		// be NULL-terminated, so we can cast it to char * directly.
 		// Store the pointer to it in msg struct for freeing it later.
@@ -336,7 +366,7 @@ static la_proto_node *la_miam_file_segment_parse(char const *reg, char const *tx
 	// or not.
 	if(rtables != NULL && (msg->reasm_status == LA_REASM_IN_PROGRESS ||
 				msg->reasm_status == LA_REASM_DUPLICATE)) {
-		(void)la_config_get_bool("decode_fragments", &decode_payload);
+		decode_payload = la_decoder_config_get()->decode_fragments;
 	}
 	if(decode_payload) {
 		node->next = la_miam_core_pdu_parse(txt);
@@ -358,7 +388,8 @@ static void la_miam_file_segment_destroy(void *data) {
 	LA_XFREE(msg);
 }
 
-static la_proto_node *la_miam_file_transfer_abort_parse(char const *txt) {
+static la_proto_node *la_miam_file_transfer_abort_parse(char const *reg, char const *txt,
+		la_reasm_ctx *rtables) {
 	la_assert(txt != NULL);
 
 	la_miam_file_transfer_abort_msg *msg = NULL;
@@ -383,6 +414,19 @@ static la_proto_node *la_miam_file_transfer_abort_parse(char const *txt) {
 
 	la_debug_print(D_INFO, "file_id: %u reason: %u\n", msg->file_id, msg->reason);
 
+	// The transfer won't be continued, so release its reassembly state now
+	// instead of waiting for the timeout.
+	if(rtables != NULL && reg != NULL) {
+		la_reasm_table *miam_file_table = la_reasm_table_lookup(rtables,
+				&la_DEF_miam_file_segment_message);
+		if(miam_file_table != NULL) {
+			la_miam_file_key msg_key;
+			la_miam_file_key_fill(&msg_key, reg, msg->file_id);
+			msg->reasm_released = la_reasm_payload_discard_with_key(miam_file_table,
+					&msg_key, la_miam_file_key_hash(&msg_key));
+		}
+	}
+
 	la_proto_node *node = la_proto_node_new();
 	node->td = &la_DEF_miam_file_transfer_abort_message;
 	node->data = msg;
@@ -472,7 +516,7 @@ hdr_error:
 	return NULL;
 }
 
-la_proto_node *la_miam_parse_and_reassemble(char const *reg, char const *txt,
+static la_proto_node *la_miam_parse_and_reassemble_internal(char const *reg, char const *txt,
 		la_reasm_ctx *rtables, struct timeval rx_time) {
 	if(txt == NULL) {
 		return NULL;
@@ -511,7 +555,7 @@ la_proto_node *la_miam_parse_and_reassemble(char const *reg, char const *txt,
 			next_node = la_miam_file_segment_parse(reg, txt, rtables, rx_time);
 			break;
 		case LA_MIAM_FID_FILE_TRANSFER_ABORT:
-			next_node = la_miam_file_transfer_abort_parse(txt);
+			next_node = la_miam_file_transfer_abort_parse(reg, txt, rtables);
 			break;
 		case LA_MIAM_FID_XOFF_IND:
 			next_node = la_miam_xoff_ind_parse(txt);
@@ -534,6 +578,14 @@ la_proto_node *la_miam_parse_and_reassemble(char const *reg, char const *txt,
 	return node;
 }
 
+la_proto_node *la_miam_parse_and_reassemble(char const *reg, char const *txt,
+		la_reasm_ctx *rtables, struct timeval rx_time) {
+	LA_ALLOC_MODULE_ENTER(LA_ALLOC_MODULE_MIAM);
+	la_proto_node *node = la_miam_parse_and_reassemble_internal(reg, txt, rtables, rx_time);
+	LA_ALLOC_MODULE_LEAVE();
+	return node;
+}
+
 la_proto_node *la_miam_parse(char const *txt) {
 	return la_miam_parse_and_reassemble(NULL, txt, NULL,
 			(struct timeval){ .tv_sec = 0, .tv_usec = 0});
@@ -650,6 +702,9 @@ static void la_miam_file_transfer_abort_format_text(la_vstring *vstr, void const
 	char *descr = la_dict_search(abort_reasons, msg->reason);
 	LA_ISPRINTF(vstr, indent, "Reason: %u (%s)\n", msg->reason,
 			(descr != NULL ? descr : "unknown"));
+	if(msg->reasm_released) {
+		LA_ISPRINTF(vstr, indent, "Reassembly: partial file discarded\n");
+	}
 }
 
 static void la_miam_file_transfer_abort_format_json(la_vstring *vstr, void const *data) {
@@ -659,6 +714,7 @@ static void la_miam_file_transfer_abort_format_json(la_vstring *vstr, void const
 	la_miam_file_transfer_abort_msg const *msg = data;
 	la_json_append_int64(vstr, "file_id", msg->file_id);
 	la_json_append_int64(vstr, "reason", msg->reason);
+	la_json_append_bool(vstr, "reasm_released", msg->reasm_released);
 }
 
 static void la_miam_xoff_ind_format_text(la_vstring *vstr, void const *data, int indent) {
@@ -83,8 +83,13 @@ typedef struct {
 typedef struct {
 	uint16_t file_id;
 	uint16_t reason;
+	// reasm_released takes the space of reserved0, so that the layout
+	// of the structure does not change
+	union {
+		bool reasm_released;	// partially reassembled file has been discarded
+		void (*reserved0)(void);
+	};
 // reserved for future use
-	void (*reserved0)(void);
 	void (*reserved1)(void);
 	void (*reserved2)(void);
 	void (*reserved3)(void);
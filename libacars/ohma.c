@@ -6,7 +6,7 @@
 
 #include "config.h"                 // WITH_ZLIB, WITH_JANSSON
 #define _GNU_SOURCE                 // for memmem()
-#include <string.h>                 // strlen, memmem
+#include <string.h>                 // strlen, memmem, memcpy, memcmp, memchr
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>               // struct timeval
 #endif
@@ -15,7 +15,7 @@
 #endif
 #include <libacars/libacars.h>      // la_proto_node, la_type_descriptor
 #include <libacars/reassembly.h>
-#include <libacars/util.h>          // la_base64_decode, la_json_pretty_print
+#include <libacars/util.h>          // la_base64_decode, la_json_pretty_print, la_hash_words, LA_XSTRDUP
 #include <libacars/dict.h>          // la_dict, la_dict_search
 #include <libacars/macros.h>        // la_debug_print()
 #include <libacars/json.h>          // ja_json_*
@@ -35,22 +35,38 @@ static struct timeval const la_ohma_reasm_timeout = {
 	.tv_usec = 0
 };
 
+// Reassembly key. The registration number is stored as a zero-padded
+// fixed-width field, so that it can be hashed and compared as two 64-bit
+// words. convo_id has variable length. Keys stored in the reassembly table
+// keep it in the same memory block as the key itself.
 typedef struct {
-	char *reg, *convo_id;
+	union {
+		char reg[16];
+		uint64_t w[2];
+	} r;
+	size_t convo_id_len;
+	char const *convo_id;
+	char convo_id_buf[];
 } la_ohma_key;
 
+static void la_ohma_key_fill(la_ohma_key *key, la_ohma_msg const *msg) {
+	key->r.w[0] = key->r.w[1] = 0;
+	la_strpad(key->r.reg, msg->reg, sizeof(key->r.reg));
+	key->convo_id = msg->convo_id;
+	key->convo_id_len = strlen(msg->convo_id);
+}
+
 static uint32_t la_ohma_key_hash(void const *key) {
 	la_ohma_key const *k = key;
-	uint32_t h = la_hash_string(k->reg, LA_HASH_INIT);
-	h = la_hash_string(k->convo_id, h);
-	return h;
+	return la_hash_string(k->convo_id, la_hash_words(k->r.w, 2));
 }
 
 static bool la_ohma_key_compare(void const *key1, void const *key2) {
 	la_ohma_key const *k1 = key1;
 	la_ohma_key const *k2 = key2;
-	return (!strcmp(k1->reg, k2->reg) &&
-			!strcmp(k1->convo_id, k2->convo_id));
+	return k1->r.w[0] == k2->r.w[0] && k1->r.w[1] == k2->r.w[1] &&
+		k1->convo_id_len == k2->convo_id_len &&
+		memcmp(k1->convo_id, k2->convo_id, k1->convo_id_len) == 0;
 }
 
 static void la_ohma_key_destroy(void *ptr) {
@@ -58,28 +74,51 @@ static void la_ohma_key_destroy(void *ptr) {
 		return;
 	}
 	la_ohma_key *key = ptr;
-	la_debug_print(D_INFO, "DESTROY KEY %s %s\n", key->reg, key->convo_id);
-	LA_XFREE(key->reg);
-	LA_XFREE(key->convo_id);
+	la_debug_print(D_INFO, "DESTROY KEY %.16s %s\n", key->r.reg, key->convo_id);
 	LA_XFREE(key);
 }
 
 static void *la_ohma_key_get(void const *msg) {
 	la_assert(msg != NULL);
 	la_ohma_msg const *amsg = msg;
-	LA_NEW(la_ohma_key, key);
-	key->reg = strdup(amsg->reg);
-	key->convo_id = strdup(amsg->convo_id);
-	la_debug_print(D_INFO, "ALLOC KEY %s %s\n", key->reg, key->convo_id);
+	size_t convo_id_len = strlen(amsg->convo_id);
+	la_ohma_key *key = LA_HEAP_XCALLOC(1, sizeof(la_ohma_key) + convo_id_len + 1);
+	la_ohma_key_fill(key, amsg);
+	memcpy(key->convo_id_buf, amsg->convo_id, convo_id_len + 1);
+	key->convo_id = key->convo_id_buf;
+	la_debug_print(D_INFO, "ALLOC KEY %.16s %s\n", key->r.reg, key->convo_id);
 	return (void *)key;
 }
 
 static void *la_ohma_tmp_key_get(void const *msg) {
 	la_assert(msg != NULL);
-	la_ohma_msg const *amsg = msg;
-	LA_NEW(la_ohma_key, key);
-	key->reg = (char *)amsg->reg;
-	key->convo_id = (char *)amsg->convo_id;
+	LA_HEAP_NEW(la_ohma_key, key);
+	la_ohma_key_fill(key, msg);
+	return (void *)key;
+}
+
+// Serialized form: reg (fixed width) followed by convo_id (without the NULL byte)
+static size_t la_ohma_key_serialize(void const *key, uint8_t *buf, size_t buflen) {
+	la_ohma_key const *k = key;
+	size_t len = sizeof(k->r.reg) + k->convo_id_len;
+	if(buflen >= len) {
+		memcpy(buf, k->r.reg, sizeof(k->r.reg));
+		memcpy(buf + sizeof(k->r.reg), k->convo_id, k->convo_id_len);
+	}
+	return len;
+}
+
+static void *la_ohma_key_deserialize(uint8_t const *buf, size_t len) {
+	size_t reg_len = sizeof(((la_ohma_key *)0)->r.reg);
+	if(len < reg_len || memchr(buf + reg_len, '\0', len - reg_len) != NULL) {
+		return NULL;
+	}
+	size_t convo_id_len = len - reg_len;
+	la_ohma_key *key = LA_HEAP_XCALLOC(1, sizeof(la_ohma_key) + convo_id_len + 1);
+	memcpy(key->r.reg, buf, reg_len);
+	memcpy(key->convo_id_buf, buf + reg_len, convo_id_len);
+	key->convo_id = key->convo_id_buf;
+	key->convo_id_len = convo_id_len;
 	return (void *)key;
 }
 
@@ -90,13 +129,19 @@ static la_reasm_table_funcs ohma_reasm_funcs = {
 	.compare_keys = la_ohma_key_compare,
 	.destroy_key = la_ohma_key_destroy
 };
+
+static la_reasm_key_codec const ohma_reasm_key_codec = {
+	.name = "ohma",
+	.serialize_key = la_ohma_key_serialize,
+	.deserialize_key = la_ohma_key_deserialize
+};
 #endif  // WITH_JANSSON
 
 /********************************************************************************
  * OHMA parsing and formatting functions
  ********************************************************************************/
 
-la_proto_node *la_ohma_parse_and_reassemble(char const *reg, char const *txt,
+static la_proto_node *la_ohma_parse_and_reassemble_internal(char const *reg, char const *txt,
 		la_reasm_ctx *rtables, struct timeval rx_time) {
 #ifdef WITH_ZLIB
 	if(txt == NULL) {
@@ -226,9 +271,9 @@ restart:
 		json_decref(root);
 		goto json_fail;
 	}
-	msg->version = strdup(version);
+	msg->version = LA_XSTRDUP(version);
 	if(convo_id) {
-		msg->convo_id = strdup(convo_id);
+		msg->convo_id = LA_XSTRDUP(convo_id);
 	}
 	char *sym_key = NULL, *iv = NULL, *signature = NULL;
 	if(json_unpack_ex(root, &err, 0LU, "{s?:s, s?:s, s?:s}",
@@ -270,10 +315,17 @@ restart:
 			if(ohma_rtable == NULL) {
 				ohma_rtable = la_reasm_table_new(rtables, &la_DEF_ohma_msg,
 						ohma_reasm_funcs, LA_OHMA_REASM_TABLE_CLEANUP_INTERVAL);
+				la_reasm_table_key_codec_set(ohma_rtable, &ohma_reasm_key_codec);
 			}
-			msg->reasm_status = la_reasm_fragment_add(ohma_rtable,
+			la_ohma_key tmp_key;
+			la_ohma_key_fill(&tmp_key, msg);
+			uint32_t key_hash = la_ohma_key_hash(&tmp_key);
+			int reasm_len = -1;
+			msg->reasm_status = la_reasm_fragment_add_and_reassemble(ohma_rtable,
 					&(la_reasm_fragment_info){
 					.msg_info = msg,
+					.tmp_key = &tmp_key,
+					.key_hash = key_hash,
 					.msg_data = (uint8_t *)message,
 					.msg_data_len = strlen(message),
 					.total_pdu_len = 0,        // not used here
@@ -284,11 +336,8 @@ restart:
 					.seq_num_wrap = SEQ_WRAP_NONE,
 					.is_final_fragment = false,
 					.total_fragment_cnt = msg_total,
-					.flags = LA_ALLOW_OUT_OF_ORDER_DELIVERY
-					});
-			if(msg->reasm_status == LA_REASM_COMPLETE) {
-				la_reasm_payload_get(ohma_rtable, msg, &reassembled_message);
-			}
+					.flags = LA_ALLOW_OUT_OF_ORDER_DELIVERY | LA_REASM_KEY_HASH_SET
+					}, &reassembled_message, &reasm_len);
 		}
 	} else {
 		msg->reasm_status = LA_REASM_SKIPPED;
@@ -298,7 +347,7 @@ restart:
 		msg->payload = la_octet_string_new(reassembled_message,
 				strlen((char *)reassembled_message));
 	} else {
-		msg->payload = la_octet_string_new(strdup(message), strlen(message));
+		msg->payload = la_octet_string_new(LA_XSTRDUP(message), strlen(message));
 	}
 
 	LA_XFREE(inflated.buf);
@@ -325,6 +374,14 @@ end:
 #endif  // WITH_ZLIB
 }
 
+la_proto_node *la_ohma_parse_and_reassemble(char const *reg, char const *txt,
+		la_reasm_ctx *rtables, struct timeval rx_time) {
+	LA_ALLOC_MODULE_ENTER(LA_ALLOC_MODULE_OHMA);
+	la_proto_node *node = la_ohma_parse_and_reassemble_internal(reg, txt, rtables, rx_time);
+	LA_ALLOC_MODULE_LEAVE();
+	return node;
+}
+
 static void la_ohma_msg_destroy(void *data) {
 	if(data == NULL) {
 		return;
@@ -0,0 +1,94 @@
+/*
+ *  This file is a part of libacars
+ *
+ *  Copyright (c) 2018-2023 Tomasz Lemiech <szpajder@gmail.com>
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <libacars/parity.h>
+
+// ACARS characters are 7-bit ASCII with an odd parity bit.
+//
+// Vectorized versions of la_parity_strip() are selected at compile time.
+// SSE2 is always available on x86-64. AVX2 is used if the compiler has been
+// told that the target CPU supports it (eg. with -march=native or -mavx2).
+#if defined(__AVX2__)
+#define LA_PARITY_AVX2
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LA_PARITY_SSE2
+#include <emmintrin.h>
+#endif
+
+// 0x6996 is a 16-bit lookup table of parities of all 4-bit values
+static inline bool la_parity_ok(uint8_t c) {
+	return (0x6996 >> ((c ^ (c >> 4)) & 0xf)) & 1;
+}
+
+// Strips parity bits from len characters in src, replaces NULLs with dots
+// to make the text printable and stores the result in dst.
+// Returns the number of characters with invalid parity.
+int la_parity_strip(char *dst, uint8_t const *src, int len) {
+	int i = 0;
+	int errors = 0;
+	// Parity of each byte is computed by folding its bits onto the lowest
+	// bit with shifts and XORs. Shifts operate on 16-bit lanes, so the low
+	// byte of each lane gets some bits of the high byte, but only on bit
+	// positions which are not used. Bytes with bit 0 clear have even parity;
+	// they are counted with SAD (sum of absolute differences) against zero.
+#if defined(LA_PARITY_AVX2)
+	__m256i const low7 = _mm256_set1_epi8(0x7f);
+	__m256i const one = _mm256_set1_epi8(1);
+	__m256i const dot = _mm256_set1_epi8('.');
+	__m256i const zero = _mm256_setzero_si256();
+	__m256i bad_cnt = zero;
+	for(; i + 32 <= len; i += 32) {
+		__m256i v = _mm256_loadu_si256((__m256i const *)(src + i));
+		__m256i p = _mm256_xor_si256(v, _mm256_srli_epi16(v, 4));
+		p = _mm256_xor_si256(p, _mm256_srli_epi16(p, 2));
+		p = _mm256_xor_si256(p, _mm256_srli_epi16(p, 1));
+		bad_cnt = _mm256_add_epi64(bad_cnt, _mm256_sad_epu8(_mm256_andnot_si256(p, one), zero));
+		__m256i c = _mm256_and_si256(v, low7);
+		c = _mm256_or_si256(c, _mm256_and_si256(_mm256_cmpeq_epi8(c, zero), dot));
+		_mm256_storeu_si256((__m256i *)(dst + i), c);
+	}
+	uint64_t sums[4];
+	_mm256_storeu_si256((__m256i *)sums, bad_cnt);
+	errors = (int)(sums[0] + sums[1] + sums[2] + sums[3]);
+#elif defined(LA_PARITY_SSE2)
+	__m128i const low7 = _mm_set1_epi8(0x7f);
+	__m128i const one = _mm_set1_epi8(1);
+	__m128i const dot = _mm_set1_epi8('.');
+	__m128i const zero = _mm_setzero_si128();
+	__m128i bad_cnt = zero;
+	for(; i + 16 <= len; i += 16) {
+		__m128i v = _mm_loadu_si128((__m128i const *)(src + i));
+		__m128i p = _mm_xor_si128(v, _mm_srli_epi16(v, 4));
+		p = _mm_xor_si128(p, _mm_srli_epi16(p, 2));
+		p = _mm_xor_si128(p, _mm_srli_epi16(p, 1));
+		bad_cnt = _mm_add_epi64(bad_cnt, _mm_sad_epu8(_mm_andnot_si128(p, one), zero));
+		__m128i c = _mm_and_si128(v, low7);
+		c = _mm_or_si128(c, _mm_and_si128(_mm_cmpeq_epi8(c, zero), dot));
+		_mm_storeu_si128((__m128i *)(dst + i), c);
+	}
+	uint64_t sums[2];
+	_mm_storeu_si128((__m128i *)sums, bad_cnt);
+	errors = (int)(sums[0] + sums[1]);
+#endif
+	for(; i < len; i++) {
+		errors += !la_parity_ok(src[i]);
+		char c = src[i] & 0x7f;
+		dst[i] = c != '\0' ? c : '.';
+	}
+	return errors;
+}
+
+// Returns the number of characters with invalid parity in buf
+int la_parity_error_count(uint8_t const *buf, int len) {
+	int errors = 0;
+	for(int i = 0; i < len; i++) {
+		errors += !la_parity_ok(buf[i]);
+	}
+	return errors;
+}
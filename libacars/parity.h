@@ -0,0 +1,15 @@
+/*
+ *  This file is a part of libacars
+ *
+ *  Copyright (c) 2018-2023 Tomasz Lemiech <szpajder@gmail.com>
+ */
+
+#ifndef LA_PARITY_H
+#define LA_PARITY_H
+
+#include <stdint.h>
+
+int la_parity_strip(char *dst, uint8_t const *src, int len);
+int la_parity_error_count(uint8_t const *buf, int len);
+
+#endif // !LA_PARITY_H
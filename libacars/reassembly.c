@@ -4,42 +4,137 @@
  *  Copyright (c) 2018-2023 Tomasz Lemiech <szpajder@gmail.com>
  */
 
-#include "config.h"                     // HAVE_SYS_TIME_H
+#include "config.h"                     // HAVE_SYS_TIME_H, WITH_PTHREADS
 #ifdef HAVE_SYS_TIME_H
 #include <sys/time.h>                   // struct timeval
 #endif
+#ifdef WITH_PTHREADS
+#include <pthread.h>                    // pthread_mutex_*, pthread_rwlock_*
+#endif
 #include <string.h>                     // strdup
 #include <libacars/macros.h>            // la_assert
+#include <libacars/libacars.h>          // LA_ALLOC_MODULE_REASSEMBLY
 #include <libacars/hash.h>              // la_hash
-#include <libacars/list.h>              // la_list
-#include <libacars/util.h>              // LA_XCALLOC, LA_XFREE, la_octet_string
+#include <libacars/vec.h>               // la_vec
+#include <libacars/arena.h>             // la_arena_get
+#include <libacars/util.h>              // LA_HEAP_XCALLOC, LA_HEAP_XREALLOC, LA_XCALLOC, LA_XFREE, LA_ALLOC_MODULE_ENTER
 #include <libacars/reassembly.h>
 
+// Entries are linked into two LRU lists - one per table and one per context.
+enum {
+	LA_REASM_LRU_TABLE,
+	LA_REASM_LRU_CTX,
+	LA_REASM_LRU_CNT
+};
+
+typedef struct {
+	struct la_reasm_table_entry_s *head;    /* most recently updated entry */
+	struct la_reasm_table_entry_s *tail;    /* least recently updated entry */
+} la_reasm_lru;
+
+// Memory usage of a table or of the whole context
+typedef struct {
+	la_reasm_limits limits;             /* limits set by the user (divided
+	                                       by the number of shards) */
+	la_reasm_lru lru;                   /* entries in LRU order */
+	size_t bytes;                       /* memory held by entries */
+	size_t entries;                     /* number of entries */
+} la_reasm_usage;
+
+// Table entries are distributed across shards by their key hash. A context
+// created with la_reasm_ctx_new() has a single shard. Each shard of the
+// context has a lock, which guards the context usage of this shard and the
+// corresponding shards of all tables in the context.
+typedef struct {
+	la_reasm_usage usage;               /* memory usage and limits of all tables
+	                                       in this shard */
+	bool locking;                       /* true if the lock shall be used */
+#ifdef WITH_PTHREADS
+	pthread_mutex_t lock;
+#endif
+} la_reasm_ctx_shard;
+
+typedef struct {
+	la_reasm_ctx_shard *ctx_shard;      /* the context shard guarding this shard */
+	la_hash *fragment_table;            /* keyed with packet identifiers, values are
+	                                       la_reasm_table_entries */
+	struct la_reasm_table_entry_s **expiry_heap;
+	                                    /* binary min-heap of table entries ordered
+	                                       by their expiry deadlines */
+	size_t expiry_heap_len;             /* number of entries in expiry_heap */
+	size_t expiry_heap_size;            /* allocated size of expiry_heap */
+	la_reasm_usage usage;               /* memory usage and limits of this shard */
+	la_reasm_table_stats stats;         /* statistics (entries and bytes fields
+	                                       are taken from usage when requested) */
+	la_hash *timeout_classes;           /* la_reasm_timeout_classes keyed by their
+	                                       ids (created on first use) */
+	struct la_reasm_gap_marker_s *gap_markers;
+	                                    /* ring of LA_REASM_GAP_MARKER_CNT markers of
+	                                       recently expired adaptive entries
+	                                       (created on first use) */
+	size_t gap_marker_next;             /* ring slot to be used next */
+} la_reasm_shard;
+
 typedef struct la_reasm_table_s {
+	la_reasm_ctx *rctx;                 /* the context owning this table */
 	void const *key;                    /* a pointer identifying the protocol
 	                                       owning this reasm_table (la_type_descriptor
 	                                       can be used for this purpose). Due to small
 	                                       number of protocols, hash would be an overkill
 	                                       here. */
-	la_hash *fragment_table;            /* keyed with packet identifiers, values are
-	                                       la_reasm_table_entries */
 	la_reasm_table_funcs funcs;         /* protocol-specific callbacks */
-	int cleanup_interval;               /* expire old entries every cleanup_interval
-	                                       number of processed fragments */
-	int frag_cnt;                       /* counts added fragments (up to cleanup_interval) */
+	int cleanup_interval;               /* unused, retained for API compatibility */
+	la_reasm_shard *shards;             /* rctx->shard_cnt shards */
+	la_reasm_key_codec codec;           /* key codec for snapshots
+	                                       (codec.name is NULL if not set) */
+	la_reasm_expire_func *expire_cb;    /* called for expired incomplete entries */
+	void *expire_cb_ctx;                /* context pointer passed to expire_cb */
 } la_reasm_table;
 
 struct la_reasm_ctx_s {
-	la_list *rtables;                   /* list of reasm_tables, one per protocol */
+	la_vec *rtables;                    /* reasm_tables, one per protocol */
+	size_t shard_cnt;                   /* number of shards (power of 2) */
+	int shard_bits;                     /* log2(shard_cnt) */
+	la_reasm_ctx_shard *shards;
+	la_vec *pending_sections;           /* restored table sections waiting for
+	                                       their tables to be created */
+	la_vec *expiry_cbs;                 /* expiry callbacks to be set on tables
+	                                       when they get created */
+	bool locking;                       /* true if this context may be used by
+	                                       multiple threads */
+#ifdef WITH_PTHREADS
+	pthread_rwlock_t rtables_lock;      /* guards rtables */
+#endif
 };
 
 typedef struct la_reasm_fragment_s {
 	int seq_num;                        /* sequence number of this fragment */
-	la_octet_string payload;            /* payload of this fragment */
+	int offset;                         /* offset of this fragment's payload in the payload buffer */
+	int len;                            /* payload length of this fragment */
 } la_reasm_fragment;
 
 // the header of the fragment list
-typedef struct {
+typedef struct la_reasm_table_entry_s {
+	la_reasm_table *rtable;             /* the table owning this entry */
+
+	la_reasm_shard *shard;              /* the table shard holding this entry */
+
+	void *key;                          /* the hash key of this entry */
+
+	uint32_t key_hash;                  /* hash value of the key */
+
+	struct timeval deadline;            /* the entry expires when a fragment with
+	                                       rx_time later than this is processed */
+
+	size_t expiry_heap_idx;             /* position of this entry in shard->expiry_heap */
+
+	struct {
+		struct la_reasm_table_entry_s *prev, *next;
+	} lru[LA_REASM_LRU_CNT];            /* links in table and context LRU lists */
+
+	size_t mem_size;                    /* memory held by this entry (as accounted
+	                                       in table and context usage) */
+
 	int prev_seq_num;                   /* sequence number of previous fragment */
 
 	int frags_collected_total_len;      /* sum of msg_data_len for all fragments received */
@@ -56,52 +151,623 @@ typedef struct {
 
 	struct timeval reasm_timeout;       /* reassembly timeout to be applied to this message */
 
-	la_list *fragment_list;             /* fragments gathered so far (list of la_reasm_fragments) */
+	uint8_t *payload;                   /* payloads of all fragments gathered so far,
+	                                       stored contiguously in fragment order */
+
+	int payload_size;                   /* allocated size of the payload buffer */
+
+	la_reasm_fragment *fragments;       /* fragment index - locations of fragments
+	                                       in the payload buffer, in fragment order */
+
+	int fragments_size;                 /* allocated size of the fragment index */
+
+	bool complete;                      /* true if the message has been reassembled
+	                                       completely (but not retrieved yet) */
+
+	bool out_of_order;                  /* out-of-order delivery is allowed */
+
+	bool fragments_sorted;              /* true if the fragment index (and the payload)
+	                                       is in seq_num order. Out-of-order fragments
+	                                       are appended in arrival order and sorted
+	                                       only when needed. */
+
+	int seq_num_first;                  /* sequence number of the first fragment
+	                                       (SEQ_FIRST_NONE if unknown) */
+
+	int seq_num_final;                  /* sequence number of the final fragment
+	                                       (SEQ_FIRST_NONE if not received yet) */
+
+	int seq_num_min, seq_num_max;       /* range of collected sequence numbers */
+
+	uint64_t *seq_bitmap;               /* collected sequence numbers (out_of_order only) */
+
+	int seq_bitmap_base;                /* sequence number of bit 0 in seq_bitmap */
+
+	int seq_bitmap_words;               /* size of seq_bitmap in 64-bit words */
+
+	bool seq_bitmap_overflow;           /* sequence numbers span too large range
+	                                       to fit in a bitmap */
+
+	bool adaptive_timeout;              /* expire the entry when no fragment arrives
+	                                       within gap_timeout */
+
+	uint32_t timeout_class;             /* timeout class of this message (adaptive_timeout only) */
+
+	struct timeval gap_timeout;         /* maximum time between fragments (adaptive_timeout only) */
+
+	struct timeval last_frag_rx_time;   /* time of arrival of the most recent fragment */
 } la_reasm_table_entry;
 
-la_reasm_ctx *la_reasm_ctx_new() {
-	LA_NEW(la_reasm_ctx, rctx);
+// An expired entry detached from its table, waiting to be passed to
+// the expiry callback once the shard lock has been released
+typedef struct la_reasm_expired_entry_s {
+	la_reasm_table_entry entry;         /* copy of the expired entry (it owns the key,
+	                                       the payload and the fragment index) */
+	la_reasm_expire_func *cb;           /* expiry callback in effect at the time of expiry */
+	void *cb_ctx;                       /* context pointer passed to cb */
+	struct la_reasm_expired_entry_s *next;
+} la_reasm_expired_entry;
+
+// An expiry callback set on a table which does not exist yet
+typedef struct {
+	void const *table_id;
+	la_reasm_expire_func *cb;
+	void *cb_ctx;
+} la_reasm_expiry_cb_binding;
+
+// A table section of a restored snapshot (see la_reasm_ctx_restore())
+typedef struct {
+	char *name;                         /* codec name of the table */
+	uint8_t *data;                      /* serialized entries */
+	size_t len;                         /* length of data */
+	uint32_t entry_cnt;                 /* number of entries in data */
+} la_reasm_snapshot_section;
+
+static void la_reasm_snapshot_section_destroy(void *ptr) {
+	if(ptr == NULL) {
+		return;
+	}
+	la_reasm_snapshot_section *section = ptr;
+	LA_XFREE(section->name);
+	LA_XFREE(section->data);
+	LA_XFREE(section);
+}
+
+/********************************************************************************
+ * Shards and locking
+ ********************************************************************************/
+
+static void la_reasm_ctx_shard_lock(la_reasm_ctx_shard *ctx_shard) {
+#ifdef WITH_PTHREADS
+	if(ctx_shard->locking) {
+		pthread_mutex_lock(&ctx_shard->lock);
+	}
+#else
+	LA_UNUSED(ctx_shard);
+#endif
+}
+
+static void la_reasm_ctx_shard_unlock(la_reasm_ctx_shard *ctx_shard) {
+#ifdef WITH_PTHREADS
+	if(ctx_shard->locking) {
+		pthread_mutex_unlock(&ctx_shard->lock);
+	}
+#else
+	LA_UNUSED(ctx_shard);
+#endif
+}
+
+static void la_reasm_rtables_rdlock(la_reasm_ctx *rctx) {
+#ifdef WITH_PTHREADS
+	if(rctx->locking) {
+		pthread_rwlock_rdlock(&rctx->rtables_lock);
+	}
+#else
+	LA_UNUSED(rctx);
+#endif
+}
+
+static void la_reasm_rtables_wrlock(la_reasm_ctx *rctx) {
+#ifdef WITH_PTHREADS
+	if(rctx->locking) {
+		pthread_rwlock_wrlock(&rctx->rtables_lock);
+	}
+#else
+	LA_UNUSED(rctx);
+#endif
+}
+
+static void la_reasm_rtables_unlock(la_reasm_ctx *rctx) {
+#ifdef WITH_PTHREADS
+	if(rctx->locking) {
+		pthread_rwlock_unlock(&rctx->rtables_lock);
+	}
+#else
+	LA_UNUSED(rctx);
+#endif
+}
+
+// Returns the shard of the table where the entry with the given key hash
+// belongs. Uses the upper bits of the multiplicative hash, since the lower
+// bits of the key hash select the slot within the shard hash table.
+static la_reasm_shard *la_reasm_shard_get(la_reasm_table const *rtable, uint32_t key_hash) {
+	int shard_bits = rtable->rctx->shard_bits;
+	if(shard_bits == 0) {
+		return rtable->shards;
+	}
+	return rtable->shards + ((uint32_t)(key_hash * 2654435769U) >> (32 - shard_bits));
+}
+
+// Limits are enforced in each shard separately, so divide them evenly.
+static la_reasm_limits la_reasm_limits_per_shard(la_reasm_limits const *limits, size_t shard_cnt) {
+	if(limits == NULL) {
+		return (la_reasm_limits){ 0 };
+	}
+	la_reasm_limits result = *limits;
+	result.max_bytes = (limits->max_bytes + shard_cnt - 1) / shard_cnt;
+	result.max_entries = (limits->max_entries + shard_cnt - 1) / shard_cnt;
+	return result;
+}
+
+#define LA_REASM_DEFAULT_SHARD_CNT 16
+#define LA_REASM_MAX_SHARD_CNT 1024
+
+static la_reasm_ctx *la_reasm_ctx_create(int shard_cnt, bool locking, la_reasm_limits const *limits) {
+	LA_HEAP_NEW(la_reasm_ctx, rctx);
+	rctx->shard_cnt = 1;
+	while((int)rctx->shard_cnt < shard_cnt && rctx->shard_cnt < LA_REASM_MAX_SHARD_CNT) {
+		rctx->shard_cnt *= 2;
+		rctx->shard_bits++;
+	}
+	rctx->locking = locking;
+	rctx->rtables = la_vec_new();
+	rctx->pending_sections = la_vec_new();
+	rctx->expiry_cbs = la_vec_new();
+	rctx->shards = LA_HEAP_XCALLOC(rctx->shard_cnt, sizeof(la_reasm_ctx_shard));
+	la_reasm_limits shard_limits = la_reasm_limits_per_shard(limits, rctx->shard_cnt);
+	for(size_t i = 0; i < rctx->shard_cnt; i++) {
+		rctx->shards[i].usage.limits = shard_limits;
+		rctx->shards[i].locking = locking;
+#ifdef WITH_PTHREADS
+		if(locking) {
+			pthread_mutex_init(&rctx->shards[i].lock, NULL);
+		}
+#endif
+	}
+#ifdef WITH_PTHREADS
+	if(locking) {
+		pthread_rwlock_init(&rctx->rtables_lock, NULL);
+	}
+#endif
 	return rctx;
 }
 
-static la_reasm_fragment *la_reasm_fragment_new(int seq_num, uint8_t *payload, size_t len) {
-	LA_NEW(la_reasm_fragment, fragment);
-	fragment->seq_num = seq_num;
+la_reasm_ctx *la_reasm_ctx_new() {
+	return la_reasm_ctx_create(1, false, NULL);
+}
+
+// Creates a reassembly context with limits applying to all reassembly tables
+// in this context altogether.
+la_reasm_ctx *la_reasm_ctx_new_with_limits(la_reasm_limits const *limits) {
+	return la_reasm_ctx_create(1, false, limits);
+}
+
+// Creates a reassembly context which may be used by multiple threads
+// simultaneously. Table entries are distributed across shard_cnt shards
+// (rounded up to a power of 2), each one having a separate lock.
+// Returns NULL if the library has been built without thread support.
+la_reasm_ctx *la_reasm_ctx_new_concurrent(int shard_cnt, la_reasm_limits const *limits) {
+#ifdef WITH_PTHREADS
+	return la_reasm_ctx_create(shard_cnt > 0 ? shard_cnt : LA_REASM_DEFAULT_SHARD_CNT,
+			true, limits);
+#else
+	LA_UNUSED(shard_cnt);
+	LA_UNUSED(limits);
+	return NULL;
+#endif
+}
+
+// Do not preallocate more than this amount of memory for the payload
+// of a message just because its first fragment says it's going to be long.
+#define LA_REASM_PAYLOAD_PREALLOC_MAX 65536
 
-	if(payload != NULL && len > 0) {
-		uint8_t *buf = LA_XCALLOC(len, sizeof(uint8_t));
-		memcpy(buf, payload, len);
-		fragment->payload.buf = buf;
-		fragment->payload.len = len;
+// Makes sure that the payload buffer of the given entry can hold
+// len bytes plus a terminating NULL byte.
+static void la_reasm_payload_reserve(la_reasm_table_entry *rt_entry, int len) {
+	if(len + 1 <= rt_entry->payload_size) {
+		return;
 	}
-	return fragment;
+	int new_size = LA_MAX(2 * rt_entry->payload_size, len + 1);
+	if(rt_entry->total_pdu_len > 0 && rt_entry->total_pdu_len >= len) {
+		new_size = LA_MAX(len + 1, LA_MIN(rt_entry->total_pdu_len, LA_REASM_PAYLOAD_PREALLOC_MAX) + 1);
+	}
+	rt_entry->payload = LA_HEAP_XREALLOC(rt_entry->payload, new_size);
+	rt_entry->payload_size = new_size;
 }
 
-static void la_reasm_fragment_destroy(void *data) {
-	if(data == NULL) {
+// Limits the range of sequence numbers tracked with a bitmap. Entries with
+// sequence numbers spread more widely than this fall back to linear search.
+#define LA_REASM_SEQ_BITMAP_MAX_WORDS 1024
+
+static void la_reasm_seq_bitmap_drop(la_reasm_table_entry *rt_entry) {
+	la_debug_print(D_INFO, "seq_num range too large, not using bitmap\n");
+	LA_XFREE(rt_entry->seq_bitmap);
+	rt_entry->seq_bitmap_words = 0;
+	rt_entry->seq_bitmap_overflow = true;
+}
+
+// Marks the given sequence number as collected, growing the bitmap
+// in either direction if necessary. Bit 0 always corresponds to a multiple
+// of 64, so that rebasing moves whole words.
+static void la_reasm_seq_bitmap_set(la_reasm_table_entry *rt_entry, int seq_num) {
+	if(rt_entry->seq_bitmap_overflow) {
+		return;
+	}
+	if(seq_num < 0) {
+		la_reasm_seq_bitmap_drop(rt_entry);
+		return;
+	}
+	int seq_base = seq_num & ~63;
+	if(rt_entry->seq_bitmap_words == 0) {
+		rt_entry->seq_bitmap = LA_HEAP_XCALLOC(1, sizeof(uint64_t));
+		rt_entry->seq_bitmap_words = 1;
+		rt_entry->seq_bitmap_base = seq_base;
+	} else if(seq_base < rt_entry->seq_bitmap_base) {
+		int shift = (rt_entry->seq_bitmap_base - seq_base) / 64;
+		int new_words = rt_entry->seq_bitmap_words + shift;
+		if(new_words > LA_REASM_SEQ_BITMAP_MAX_WORDS) {
+			la_reasm_seq_bitmap_drop(rt_entry);
+			return;
+		}
+		rt_entry->seq_bitmap = LA_HEAP_XREALLOC(rt_entry->seq_bitmap, new_words * sizeof(uint64_t));
+		memmove(rt_entry->seq_bitmap + shift, rt_entry->seq_bitmap,
+				rt_entry->seq_bitmap_words * sizeof(uint64_t));
+		memset(rt_entry->seq_bitmap, 0, shift * sizeof(uint64_t));
+		rt_entry->seq_bitmap_words = new_words;
+		rt_entry->seq_bitmap_base = seq_base;
+	} else if(seq_num - rt_entry->seq_bitmap_base >= rt_entry->seq_bitmap_words * 64) {
+		int needed_words = (seq_num - rt_entry->seq_bitmap_base) / 64 + 1;
+		if(needed_words > LA_REASM_SEQ_BITMAP_MAX_WORDS) {
+			la_reasm_seq_bitmap_drop(rt_entry);
+			return;
+		}
+		int new_words = LA_MIN(LA_MAX(needed_words, 2 * rt_entry->seq_bitmap_words),
+				LA_REASM_SEQ_BITMAP_MAX_WORDS);
+		rt_entry->seq_bitmap = LA_HEAP_XREALLOC(rt_entry->seq_bitmap, new_words * sizeof(uint64_t));
+		memset(rt_entry->seq_bitmap + rt_entry->seq_bitmap_words, 0,
+				(new_words - rt_entry->seq_bitmap_words) * sizeof(uint64_t));
+		rt_entry->seq_bitmap_words = new_words;
+	}
+	int bit = seq_num - rt_entry->seq_bitmap_base;
+	rt_entry->seq_bitmap[bit / 64] |= (uint64_t)1 << (bit % 64);
+}
+
+static bool la_reasm_fragment_seq_num_already_exists(la_reasm_table_entry const *rt_entry, int seq_num) {
+	if(rt_entry->seq_bitmap_overflow) {
+		for(int i = 0; i < rt_entry->frags_collected_cnt; i++) {
+			if(rt_entry->fragments[i].seq_num == seq_num) {
+				return true;
+			}
+		}
+		return false;
+	}
+	int bit = seq_num - rt_entry->seq_bitmap_base;
+	if(bit < 0 || bit >= rt_entry->seq_bitmap_words * 64) {
+		return false;
+	}
+	return (rt_entry->seq_bitmap[bit / 64] & ((uint64_t)1 << (bit % 64))) != 0;
+}
+
+// Appends the fragment payload to the payload buffer of the entry and adds
+// the fragment to the fragment index.
+static void la_reasm_fragment_store(la_reasm_table_entry *rt_entry,
+		int seq_num, uint8_t const *data, int len) {
+	if(data == NULL || len < 0) {
+		len = 0;
+	}
+	if(rt_entry->frags_collected_cnt == rt_entry->fragments_size) {
+		rt_entry->fragments_size = rt_entry->fragments_size > 0 ? 2 * rt_entry->fragments_size : 4;
+		rt_entry->fragments = LA_HEAP_XREALLOC(rt_entry->fragments,
+				rt_entry->fragments_size * sizeof(la_reasm_fragment));
+	}
+	int offset = rt_entry->frags_collected_total_len;
+	la_reasm_payload_reserve(rt_entry, offset + len);
+	if(len > 0) {
+		memcpy(rt_entry->payload + offset, data, len);
+	}
+	rt_entry->fragments[rt_entry->frags_collected_cnt] = (la_reasm_fragment){
+		.seq_num = seq_num,
+		.offset = offset,
+		.len = len
+	};
+	rt_entry->frags_collected_total_len += len;
+	rt_entry->frags_collected_cnt++;
+}
+
+static int la_reasm_fragment_compare(void const *f1, void const *f2) {
+	int s1 = ((la_reasm_fragment const *)f1)->seq_num;
+	int s2 = ((la_reasm_fragment const *)f2)->seq_num;
+	return (s1 > s2) - (s1 < s2);
+}
+
+// Puts the fragments of an out-of-order entry (and their payloads)
+// in seq_num order. This is done once, when the message gets completed
+// (or when the contents of the entry is needed otherwise), rather than
+// on every fragment insertion.
+static void la_reasm_fragments_sort(la_reasm_table_entry *rt_entry) {
+	if(rt_entry->fragments_sorted) {
 		return;
 	}
-	la_reasm_fragment *fragment = data;
-	LA_XFREE(fragment->payload.buf);
-	LA_XFREE(fragment);
+	qsort(rt_entry->fragments, rt_entry->frags_collected_cnt, sizeof(la_reasm_fragment),
+			la_reasm_fragment_compare);
+	uint8_t *payload = LA_HEAP_XCALLOC(rt_entry->payload_size, sizeof(uint8_t));
+	int offset = 0;
+	for(int i = 0; i < rt_entry->frags_collected_cnt; i++) {
+		la_reasm_fragment *frag = rt_entry->fragments + i;
+		if(frag->len > 0) {
+			memcpy(payload + offset, rt_entry->payload + frag->offset, frag->len);
+		}
+		frag->offset = offset;
+		offset += frag->len;
+	}
+	LA_XFREE(rt_entry->payload);
+	rt_entry->payload = payload;
+	rt_entry->fragments_sorted = true;
+}
+
+// Updates the sequence number tracking state of an out-of-order entry
+// with a newly stored fragment.
+static void la_reasm_seq_num_track(la_reasm_table_entry *rt_entry, int seq_num) {
+	if(rt_entry->frags_collected_cnt == 1) {
+		rt_entry->seq_num_min = rt_entry->seq_num_max = seq_num;
+	} else {
+		if(seq_num < rt_entry->seq_num_max) {
+			rt_entry->fragments_sorted = false;
+		}
+		rt_entry->seq_num_min = LA_MIN(rt_entry->seq_num_min, seq_num);
+		rt_entry->seq_num_max = LA_MAX(rt_entry->seq_num_max, seq_num);
+	}
+	la_reasm_seq_bitmap_set(rt_entry, seq_num);
+}
+
+// Checks whether collected fragments of an out-of-order entry form
+// a contiguous sequence starting at the first fragment (if known).
+// Duplicates are never stored, so it is enough to compare the number
+// of fragments with the size of the seq_num range.
+static bool la_reasm_fragments_contiguous(la_reasm_table_entry const *rt_entry) {
+	if(rt_entry->frags_collected_cnt == 0) {
+		return false;
+	}
+	if(rt_entry->seq_num_first != SEQ_FIRST_NONE && rt_entry->seq_num_min != rt_entry->seq_num_first) {
+		return false;
+	}
+	return (int64_t)rt_entry->seq_num_max - rt_entry->seq_num_min + 1 == rt_entry->frags_collected_cnt;
+}
+
+/********************************************************************************
+ * LRU lists and memory accounting
+ ********************************************************************************/
+
+static void la_reasm_lru_unlink(la_reasm_lru *lru, la_reasm_table_entry *rt_entry, int which) {
+	la_reasm_table_entry *prev = rt_entry->lru[which].prev;
+	la_reasm_table_entry *next = rt_entry->lru[which].next;
+	if(prev != NULL) {
+		prev->lru[which].next = next;
+	} else {
+		lru->head = next;
+	}
+	if(next != NULL) {
+		next->lru[which].prev = prev;
+	} else {
+		lru->tail = prev;
+	}
+	rt_entry->lru[which].prev = rt_entry->lru[which].next = NULL;
+}
+
+static void la_reasm_lru_push_front(la_reasm_lru *lru, la_reasm_table_entry *rt_entry, int which) {
+	rt_entry->lru[which].prev = NULL;
+	rt_entry->lru[which].next = lru->head;
+	if(lru->head != NULL) {
+		lru->head->lru[which].prev = rt_entry;
+	} else {
+		lru->tail = rt_entry;
+	}
+	lru->head = rt_entry;
+}
+
+// Marks the entry as the most recently updated one.
+static void la_reasm_lru_touch(la_reasm_table_entry *rt_entry) {
+	la_reasm_usage *usage = &rt_entry->shard->usage;
+	if(usage->lru.head != rt_entry) {
+		la_reasm_lru_unlink(&usage->lru, rt_entry, LA_REASM_LRU_TABLE);
+		la_reasm_lru_push_front(&usage->lru, rt_entry, LA_REASM_LRU_TABLE);
+	}
+	usage = &rt_entry->shard->ctx_shard->usage;
+	if(usage->lru.head != rt_entry) {
+		la_reasm_lru_unlink(&usage->lru, rt_entry, LA_REASM_LRU_CTX);
+		la_reasm_lru_push_front(&usage->lru, rt_entry, LA_REASM_LRU_CTX);
+	}
+}
+
+static void la_reasm_usage_add(la_reasm_table_entry *rt_entry) {
+	la_reasm_shard *shard = rt_entry->shard;
+	la_reasm_lru_push_front(&shard->usage.lru, rt_entry, LA_REASM_LRU_TABLE);
+	la_reasm_lru_push_front(&shard->ctx_shard->usage.lru, rt_entry, LA_REASM_LRU_CTX);
+	shard->usage.entries++;
+	shard->ctx_shard->usage.entries++;
+	shard->stats.peak_entries = LA_MAX(shard->stats.peak_entries, shard->usage.entries);
+}
+
+static void la_reasm_usage_remove(la_reasm_table_entry *rt_entry) {
+	la_reasm_shard *shard = rt_entry->shard;
+	la_reasm_lru_unlink(&shard->usage.lru, rt_entry, LA_REASM_LRU_TABLE);
+	la_reasm_lru_unlink(&shard->ctx_shard->usage.lru, rt_entry, LA_REASM_LRU_CTX);
+	shard->usage.entries--;
+	shard->ctx_shard->usage.entries--;
+	shard->usage.bytes -= rt_entry->mem_size;
+	shard->ctx_shard->usage.bytes -= rt_entry->mem_size;
 }
 
-static int la_reasm_compare_fragment_seq_numbers(void const *data1, void const *data2) {
-	la_assert(data1);
-	la_assert(data2);
-	la_reasm_fragment const *f1 = data1;
-	la_reasm_fragment const *f2 = data2;
-	return f1->seq_num - f2->seq_num;
+// Recomputes the amount of memory held by the entry and updates
+// table and context usage accordingly.
+static void la_reasm_usage_update(la_reasm_table_entry *rt_entry) {
+	size_t mem_size = sizeof(la_reasm_table_entry) + (size_t)rt_entry->payload_size +
+		(size_t)rt_entry->fragments_size * sizeof(la_reasm_fragment) +
+		(size_t)rt_entry->seq_bitmap_words * sizeof(uint64_t);
+	la_reasm_shard *shard = rt_entry->shard;
+	shard->usage.bytes = shard->usage.bytes - rt_entry->mem_size + mem_size;
+	shard->ctx_shard->usage.bytes = shard->ctx_shard->usage.bytes - rt_entry->mem_size + mem_size;
+	rt_entry->mem_size = mem_size;
+	shard->stats.peak_bytes = LA_MAX(shard->stats.peak_bytes, shard->usage.bytes);
 }
 
-static bool la_reasm_fragment_seq_num_already_exists(la_list *fragment_list, int seq_num) {
-	for(la_list *l = fragment_list; l != NULL; l = la_list_next(l)) {
-		la_reasm_fragment *fragment = l->data;
-		if(fragment->seq_num == seq_num) {
-			return true;
+// Removes the entry from the table, notifying the user via the callback
+// from the limits which have caused the eviction.
+static void la_reasm_entry_evict(la_reasm_table_entry *rt_entry,
+		la_reasm_limits const *limits, la_reasm_evict_reason reason) {
+	la_reasm_table *rtable = rt_entry->rtable;
+	la_debug_print(D_INFO, "Evicting entry (reason: %d, frags: %d, bytes: %zu)\n",
+			reason, rt_entry->frags_collected_cnt, rt_entry->mem_size);
+	if(limits->evict_cb != NULL) {
+		limits->evict_cb(&(la_reasm_eviction_info){
+				.table_id = rtable->key,
+				.key = rt_entry->key,
+				.reason = reason,
+				.frags_collected_cnt = rt_entry->frags_collected_cnt,
+				.frags_collected_total_len = rt_entry->frags_collected_total_len,
+				.first_frag_rx_time = rt_entry->first_frag_rx_time
+				}, limits->evict_cb_ctx);
+	}
+	la_reasm_shard *shard = rt_entry->shard;
+	shard->stats.evicted_cnt++;
+	la_hash_remove_with_hash(shard->fragment_table, rt_entry->key, rt_entry->key_hash);
+}
+
+// Evicts least recently updated entries until there is room
+// for a new entry in the given table shard.
+static void la_reasm_entries_limit_enforce(la_reasm_shard *shard) {
+	la_reasm_usage *usage[] = { &shard->usage, &shard->ctx_shard->usage };
+	for(size_t i = 0; i < sizeof(usage) / sizeof(usage[0]); i++) {
+		size_t max_entries = usage[i]->limits.max_entries;
+		while(max_entries > 0 && usage[i]->entries >= max_entries && usage[i]->lru.tail != NULL) {
+			la_reasm_entry_evict(usage[i]->lru.tail, &usage[i]->limits, LA_REASM_EVICT_MAX_ENTRIES);
 		}
 	}
-	return false;
+}
+
+// Returns the limits which would be exceeded if new_frags more fragments
+// were added to the given entry, or NULL if they may be added.
+static la_reasm_limits const *la_reasm_fragments_limit_check(la_reasm_table_entry const *rt_entry,
+		int new_frags) {
+	la_reasm_usage const *usage[] = { &rt_entry->shard->usage, &rt_entry->shard->ctx_shard->usage };
+	for(size_t i = 0; i < sizeof(usage) / sizeof(usage[0]); i++) {
+		int max_fragments = usage[i]->limits.max_fragments_per_entry;
+		if(max_fragments > 0 && (int64_t)rt_entry->frags_collected_cnt + new_frags > max_fragments) {
+			return &usage[i]->limits;
+		}
+	}
+	return NULL;
+}
+
+// Evicts least recently updated entries until memory usage of the table
+// and the context drops below the limit. The given entry (which has just been
+// updated) is never evicted here. Returns the limits which are exceeded by
+// this entry alone or NULL if the entry fits within limits.
+static la_reasm_limits const *la_reasm_bytes_limit_enforce(la_reasm_table_entry *rt_entry) {
+	la_reasm_usage *usage[] = { &rt_entry->shard->usage, &rt_entry->shard->ctx_shard->usage };
+	for(size_t i = 0; i < sizeof(usage) / sizeof(usage[0]); i++) {
+		size_t max_bytes = usage[i]->limits.max_bytes;
+		if(max_bytes > 0 && rt_entry->mem_size > max_bytes) {
+			return &usage[i]->limits;
+		}
+	}
+	for(size_t i = 0; i < sizeof(usage) / sizeof(usage[0]); i++) {
+		size_t max_bytes = usage[i]->limits.max_bytes;
+		// rt_entry is the most recently updated one, so it's not going
+		// to be reached before the usage drops below max_bytes.
+		while(max_bytes > 0 && usage[i]->bytes > max_bytes) {
+			la_assert(usage[i]->lru.tail != rt_entry);
+			la_reasm_entry_evict(usage[i]->lru.tail, &usage[i]->limits, LA_REASM_EVICT_MAX_BYTES);
+		}
+	}
+	return NULL;
+}
+
+/********************************************************************************
+ * Expiry heap
+ ********************************************************************************/
+
+// Returns true if timestamp a is later than timestamp b.
+static bool la_reasm_timeval_after(struct timeval a, struct timeval b) {
+	return (a.tv_sec > b.tv_sec || (a.tv_sec == b.tv_sec && a.tv_usec > b.tv_usec));
+}
+
+static void la_reasm_expiry_heap_set(la_reasm_shard *shard, size_t idx,
+		la_reasm_table_entry *rt_entry) {
+	shard->expiry_heap[idx] = rt_entry;
+	rt_entry->expiry_heap_idx = idx;
+}
+
+static void la_reasm_expiry_heap_sift_up(la_reasm_shard *shard, size_t idx) {
+	la_reasm_table_entry *rt_entry = shard->expiry_heap[idx];
+	while(idx > 0) {
+		size_t parent = (idx - 1) / 2;
+		if(!la_reasm_timeval_after(shard->expiry_heap[parent]->deadline, rt_entry->deadline)) {
+			break;
+		}
+		la_reasm_expiry_heap_set(shard, idx, shard->expiry_heap[parent]);
+		idx = parent;
+	}
+	la_reasm_expiry_heap_set(shard, idx, rt_entry);
+}
+
+static void la_reasm_expiry_heap_sift_down(la_reasm_shard *shard, size_t idx) {
+	la_reasm_table_entry *rt_entry = shard->expiry_heap[idx];
+	size_t len = shard->expiry_heap_len;
+	for(;;) {
+		size_t child = 2 * idx + 1;
+		if(child >= len) {
+			break;
+		}
+		if(child + 1 < len && la_reasm_timeval_after(shard->expiry_heap[child]->deadline,
+					shard->expiry_heap[child + 1]->deadline)) {
+			child++;
+		}
+		if(!la_reasm_timeval_after(rt_entry->deadline, shard->expiry_heap[child]->deadline)) {
+			break;
+		}
+		la_reasm_expiry_heap_set(shard, idx, shard->expiry_heap[child]);
+		idx = child;
+	}
+	la_reasm_expiry_heap_set(shard, idx, rt_entry);
+}
+
+static void la_reasm_expiry_heap_push(la_reasm_shard *shard, la_reasm_table_entry *rt_entry) {
+	if(shard->expiry_heap_len == shard->expiry_heap_size) {
+		shard->expiry_heap_size = shard->expiry_heap_size > 0 ? 2 * shard->expiry_heap_size : 16;
+		shard->expiry_heap = LA_HEAP_XREALLOC(shard->expiry_heap,
+				shard->expiry_heap_size * sizeof(la_reasm_table_entry *));
+	}
+	la_reasm_expiry_heap_set(shard, shard->expiry_heap_len++, rt_entry);
+	la_reasm_expiry_heap_sift_up(shard, rt_entry->expiry_heap_idx);
+}
+
+// Restores the heap order after the deadline of the entry has changed.
+static void la_reasm_expiry_heap_update(la_reasm_shard *shard, la_reasm_table_entry *rt_entry) {
+	la_reasm_expiry_heap_sift_up(shard, rt_entry->expiry_heap_idx);
+	la_reasm_expiry_heap_sift_down(shard, rt_entry->expiry_heap_idx);
+}
+
+static void la_reasm_expiry_heap_remove(la_reasm_shard *shard, la_reasm_table_entry *rt_entry) {
+	size_t idx = rt_entry->expiry_heap_idx;
+	la_assert(idx < shard->expiry_heap_len);
+	la_assert(shard->expiry_heap[idx] == rt_entry);
+	la_reasm_table_entry *last = shard->expiry_heap[--shard->expiry_heap_len];
+	if(last != rt_entry) {
+		la_reasm_expiry_heap_set(shard, idx, last);
+		la_reasm_expiry_heap_sift_up(shard, idx);
+		la_reasm_expiry_heap_sift_down(shard, last->expiry_heap_idx);
+	}
 }
 
 static void la_reasm_table_entry_destroy(void *rt_ptr) {
@@ -109,7 +775,19 @@ static void la_reasm_table_entry_destroy(void *rt_ptr) {
 		return;
 	}
 	la_reasm_table_entry *rt_entry = rt_ptr;
-	la_list_free_full(rt_entry->fragment_list, la_reasm_fragment_destroy);
+	// The heap is already gone if the whole table is being destroyed.
+	if(rt_entry->shard->expiry_heap != NULL) {
+		la_reasm_expiry_heap_remove(rt_entry->shard, rt_entry);
+	}
+	la_reasm_usage_remove(rt_entry);
+	// The key is owned by the entry (rather than by the hash), so that
+	// it can be detached from the table together with the entry.
+	if(rt_entry->key != NULL && rt_entry->rtable->funcs.destroy_key != NULL) {
+		rt_entry->rtable->funcs.destroy_key(rt_entry->key);
+	}
+	LA_XFREE(rt_entry->payload);
+	LA_XFREE(rt_entry->fragments);
+	LA_XFREE(rt_entry->seq_bitmap);
 	LA_XFREE(rt_entry);
 }
 
@@ -118,7 +796,14 @@ static void la_reasm_table_destroy(void *table) {
 		return;
 	}
 	la_reasm_table *rtable = table;
-	la_hash_destroy(rtable->fragment_table);
+	for(size_t i = 0; i < rtable->rctx->shard_cnt; i++) {
+		la_reasm_shard *shard = rtable->shards + i;
+		LA_XFREE(shard->expiry_heap);
+		la_hash_destroy(shard->fragment_table);
+		la_hash_destroy(shard->timeout_classes);
+		LA_XFREE(shard->gap_markers);
+	}
+	LA_XFREE(rtable->shards);
 	LA_XFREE(rtable);
 }
 
@@ -127,16 +812,24 @@ void la_reasm_ctx_destroy(void *ctx) {
 		return;
 	}
 	la_reasm_ctx *rctx = ctx;
-	la_list_free_full(rctx->rtables, la_reasm_table_destroy);
+	la_vec_free_full(rctx->rtables, la_reasm_table_destroy);
+	la_vec_free_full(rctx->pending_sections, la_reasm_snapshot_section_destroy);
+	la_vec_free(rctx->expiry_cbs);
+#ifdef WITH_PTHREADS
+	if(rctx->locking) {
+		for(size_t i = 0; i < rctx->shard_cnt; i++) {
+			pthread_mutex_destroy(&rctx->shards[i].lock);
+		}
+		pthread_rwlock_destroy(&rctx->rtables_lock);
+	}
+#endif
+	LA_XFREE(rctx->shards);
 	LA_XFREE(rctx);
 }
 
-la_reasm_table *la_reasm_table_lookup(la_reasm_ctx *rctx, void const *table_id) {
-	la_assert(rctx != NULL);
-	la_assert(table_id != NULL);
-
-	for(la_list *l = rctx->rtables; l != NULL; l = la_list_next(l)) {
-		la_reasm_table *rt = l->data;
+static la_reasm_table *la_reasm_table_find(la_reasm_ctx *rctx, void const *table_id) {
+	for(size_t i = 0; i < rctx->rtables->len; i++) {
+		la_reasm_table *rt = rctx->rtables->items[i];
 		if(rt->key == table_id) {
 			return rt;
 		}
@@ -144,94 +837,609 @@ la_reasm_table *la_reasm_table_lookup(la_reasm_ctx *rctx, void const *table_id)
 	return NULL;
 }
 
+la_reasm_table *la_reasm_table_lookup(la_reasm_ctx *rctx, void const *table_id) {
+	la_assert(rctx != NULL);
+	la_assert(table_id != NULL);
+
+	la_reasm_rtables_rdlock(rctx);
+	la_reasm_table *rtable = la_reasm_table_find(rctx, table_id);
+	la_reasm_rtables_unlock(rctx);
+	return rtable;
+}
+
 #define LA_REASM_DEFAULT_CLEANUP_INTERVAL 100
 
 la_reasm_table *la_reasm_table_new(la_reasm_ctx *rctx, void const *table_id,
 		la_reasm_table_funcs funcs, int cleanup_interval) {
 	la_assert(rctx != NULL);
 	la_assert(table_id != NULL);
-	la_assert(funcs.get_key);
-	la_assert(funcs.get_tmp_key);
-	la_assert(funcs.hash_key);
-	la_assert(funcs.compare_keys);
-	la_assert(funcs.destroy_key);
+	la_assert(funcs.get_key);
+	la_assert(funcs.get_tmp_key);
+	la_assert(funcs.hash_key);
+	la_assert(funcs.compare_keys);
+	la_assert(funcs.destroy_key);
+
+	la_reasm_rtables_wrlock(rctx);
+	la_reasm_table *rtable = la_reasm_table_find(rctx, table_id);
+	if(rtable != NULL) {
+		goto end;
+	}
+	rtable = LA_HEAP_XCALLOC(1, sizeof(la_reasm_table));
+	rtable->rctx = rctx;
+	rtable->key = table_id;
+	rtable->funcs = funcs;
+	rtable->shards = LA_HEAP_XCALLOC(rctx->shard_cnt, sizeof(la_reasm_shard));
+	for(size_t i = 0; i < rctx->shard_cnt; i++) {
+		la_reasm_shard *shard = rtable->shards + i;
+		shard->ctx_shard = rctx->shards + i;
+		shard->fragment_table = la_hash_new(funcs.hash_key, funcs.compare_keys,
+				NULL, la_reasm_table_entry_destroy);
+	}
+
+	for(size_t i = 0; i < rctx->expiry_cbs->len; i++) {
+		la_reasm_expiry_cb_binding const *binding = rctx->expiry_cbs->items[i];
+		if(binding->table_id == table_id) {
+			rtable->expire_cb = binding->cb;
+			rtable->expire_cb_ctx = binding->cb_ctx;
+			break;
+		}
+	}
+
+	// Replace insane values with reasonable default
+	rtable->cleanup_interval = cleanup_interval > 0 ?
+		cleanup_interval : LA_REASM_DEFAULT_CLEANUP_INTERVAL;
+	la_vec_append(rctx->rtables, rtable);
+end:
+	la_reasm_rtables_unlock(rctx);
+	return rtable;
+}
+
+// Same as la_reasm_table_new(), but sets the limits for the new table.
+// If the table already exists, its limits are updated.
+la_reasm_table *la_reasm_table_new_with_limits(la_reasm_ctx *rctx, void const *table_id,
+		la_reasm_table_funcs funcs, la_reasm_limits const *limits) {
+	la_reasm_table *rtable = la_reasm_table_new(rctx, table_id, funcs, 0);
+	la_reasm_table_limits_set(rtable, limits);
+	return rtable;
+}
+
+// Sets limits for the given table. Entries exceeding the new limits
+// are evicted when the next fragment is added to the table.
+void la_reasm_table_limits_set(la_reasm_table *rtable, la_reasm_limits const *limits) {
+	la_assert(rtable != NULL);
+	la_reasm_limits shard_limits = la_reasm_limits_per_shard(limits, rtable->rctx->shard_cnt);
+	for(size_t i = 0; i < rtable->rctx->shard_cnt; i++) {
+		la_reasm_shard *shard = rtable->shards + i;
+		la_reasm_ctx_shard_lock(shard->ctx_shard);
+		shard->usage.limits = shard_limits;
+		la_reasm_ctx_shard_unlock(shard->ctx_shard);
+	}
+}
+
+// Computes the time when the reassembly of a message started at rx_first expires.
+static struct timeval la_reasm_deadline(struct timeval rx_first, struct timeval timeout) {
+	struct timeval deadline = {
+		.tv_sec = rx_first.tv_sec + timeout.tv_sec,
+		.tv_usec = rx_first.tv_usec + timeout.tv_usec
+	};
+	if(deadline.tv_usec >= 1000000) {
+		deadline.tv_sec += deadline.tv_usec / 1000000;
+		deadline.tv_usec %= 1000000;
+	}
+	return deadline;
+}
+
+/********************************************************************************
+ * Adaptive timeouts
+ ********************************************************************************/
+
+// Reassembly timeouts given by protocol specifications are deliberately
+// generous, so entries of messages with lost fragments are held in memory
+// long after the missing fragments could have arrived. When the caller sets
+// LA_REASM_ADAPTIVE_TIMEOUT flag, the engine records the time gaps between
+// consecutive fragments of messages of each timeout class. The entry of
+// a new message expires when no fragment has arrived for
+// LA_REASM_GAP_HEADROOM times the LA_REASM_GAP_PERCENTILE-th percentile
+// of the gaps observed so far. reasm_timeout (counted from the first
+// fragment) still applies as well.
+//
+// Gaps longer than the adaptive timeout can't be observed directly, as the
+// entry expires before the next fragment arrives. When this happens, a marker
+// holding the key hash and the time of the last fragment is kept until
+// reasm_timeout of the message runs out. If a fragment of the same message
+// arrives in the meantime, the gap is recorded before the fragment gets
+// dropped as out of sequence. Without this, the histogram could only learn
+// shorter gaps and the timeout would never catch up when the gaps grow.
+// Markers are kept in a fixed-size ring, so the oldest ones are overwritten
+// under heavy load. The gap histogram of each class is halved after
+// collecting LA_REASM_GAP_MAX_SAMPLES, so that old samples fade out.
+
+#define LA_REASM_GAP_BUCKET_CNT 84          // four buckets per octave, up to 2^22 ms
+#define LA_REASM_GAP_PERCENTILE 99
+#define LA_REASM_GAP_HEADROOM 2
+#define LA_REASM_GAP_MIN_SAMPLES 32         // use reasm_timeout until then
+#define LA_REASM_GAP_MAX_SAMPLES 4096
+#define LA_REASM_GAP_TIMEOUT_MIN_MSEC 30000LL
+#define LA_REASM_GAP_MARKER_CNT 256         // per shard
+
+typedef struct {
+	uint32_t id;                        /* timeout class (hash key) */
+	uint32_t sample_cnt;                /* sum of hist[] */
+	uint32_t hist[LA_REASM_GAP_BUCKET_CNT];
+	                                    /* histogram of gaps between fragments */
+} la_reasm_timeout_class;
+
+typedef struct la_reasm_gap_marker_s {
+	uint32_t key_hash;                  /* hash value of the key of the expired entry */
+	uint32_t timeout_class;             /* timeout class of the expired entry */
+	struct timeval last_frag_rx_time;   /* time of arrival of its most recent fragment */
+	struct timeval drop_time;           /* the marker is ignored after this time
+	                                       (zero if the slot is unused) */
+} la_reasm_gap_marker;
+
+static uint32_t la_reasm_timeout_class_hash(void const *key) {
+	return *(uint32_t const *)key;
+}
+
+static bool la_reasm_timeout_class_compare(void const *key1, void const *key2) {
+	return *(uint32_t const *)key1 == *(uint32_t const *)key2;
+}
+
+static long long la_reasm_timeval_msec(struct timeval tv) {
+	return (long long)tv.tv_sec * 1000LL + tv.tv_usec / 1000;
+}
+
+// Buckets 0-3 hold gaps of 0-3 ms. Above that there are four buckets
+// per power of two.
+static int la_reasm_gap_bucket(long long msec) {
+	if(msec < 4) {
+		return msec < 0 ? 0 : (int)msec;
+	}
+	int msb = 2;
+	while(msb < 62 && (msec >> (msb + 1)) != 0) {
+		msb++;
+	}
+	int bucket = 4 * (msb - 1) + (int)((msec >> (msb - 2)) & 3);
+	return LA_MIN(bucket, LA_REASM_GAP_BUCKET_CNT - 1);
+}
+
+// Returns the upper bound of the given bucket
+static long long la_reasm_gap_bucket_max_msec(int bucket) {
+	if(bucket < 4) {
+		return bucket + 1;
+	}
+	int msb = bucket / 4 + 1;
+	return (long long)(4 + bucket % 4 + 1) << (msb - 2);
+}
+
+static void la_reasm_gap_record(la_reasm_shard *shard, uint32_t class_id,
+		struct timeval from, struct timeval to) {
+	long long gap = la_reasm_timeval_msec(to) - la_reasm_timeval_msec(from);
+	if(gap < 0) {
+		return;
+	}
+	if(shard->timeout_classes == NULL) {
+		shard->timeout_classes = la_hash_new(la_reasm_timeout_class_hash,
+				la_reasm_timeout_class_compare, NULL, la_simple_free);
+	}
+	la_reasm_timeout_class *tclass = la_hash_lookup(shard->timeout_classes, &class_id);
+	if(tclass == NULL) {
+		tclass = LA_HEAP_XCALLOC(1, sizeof(la_reasm_timeout_class));
+		tclass->id = class_id;
+		la_hash_insert(shard->timeout_classes, &tclass->id, tclass);
+	}
+	if(tclass->sample_cnt >= LA_REASM_GAP_MAX_SAMPLES) {
+		tclass->sample_cnt = 0;
+		for(int i = 0; i < LA_REASM_GAP_BUCKET_CNT; i++) {
+			tclass->hist[i] /= 2;
+			tclass->sample_cnt += tclass->hist[i];
+		}
+	}
+	tclass->hist[la_reasm_gap_bucket(gap)]++;
+	tclass->sample_cnt++;
+}
+
+// Returns the maximum gap between fragments of a new message of the given
+// class, not exceeding max_timeout.
+static struct timeval la_reasm_gap_timeout_get(la_reasm_shard const *shard, uint32_t class_id,
+		struct timeval max_timeout) {
+	la_reasm_timeout_class const *tclass = shard->timeout_classes != NULL ?
+		la_hash_lookup(shard->timeout_classes, &class_id) : NULL;
+	if(tclass == NULL || tclass->sample_cnt < LA_REASM_GAP_MIN_SAMPLES) {
+		return max_timeout;
+	}
+	uint64_t threshold = ((uint64_t)tclass->sample_cnt * LA_REASM_GAP_PERCENTILE + 99) / 100;
+	uint64_t cnt = 0;
+	int bucket = 0;
+	for(; bucket < LA_REASM_GAP_BUCKET_CNT - 1; bucket++) {
+		cnt += tclass->hist[bucket];
+		if(cnt >= threshold) {
+			break;
+		}
+	}
+	long long max_msec = la_reasm_timeval_msec(max_timeout);
+	long long msec = la_reasm_gap_bucket_max_msec(bucket) * LA_REASM_GAP_HEADROOM;
+	msec = LA_MAX(msec, LA_MIN(LA_REASM_GAP_TIMEOUT_MIN_MSEC, max_msec));
+	if(msec >= max_msec) {
+		return max_timeout;
+	}
+	return (struct timeval){ .tv_sec = msec / 1000, .tv_usec = (msec % 1000) * 1000 };
+}
+
+// Remembers an adaptive entry which has expired because no fragment arrived
+// within its gap_timeout, so that the gap can still be learned if the next
+// fragment arrives before reasm_timeout.
+static void la_reasm_gap_marker_add(la_reasm_shard *shard, la_reasm_table_entry const *rt_entry) {
+	if(shard->gap_markers == NULL) {
+		shard->gap_markers = LA_HEAP_XCALLOC(LA_REASM_GAP_MARKER_CNT, sizeof(la_reasm_gap_marker));
+	}
+	shard->gap_markers[shard->gap_marker_next] = (la_reasm_gap_marker){
+		.key_hash = rt_entry->key_hash,
+		.timeout_class = rt_entry->timeout_class,
+		.last_frag_rx_time = rt_entry->last_frag_rx_time,
+		.drop_time = la_reasm_deadline(rt_entry->first_frag_rx_time, rt_entry->reasm_timeout)
+	};
+	shard->gap_marker_next = (shard->gap_marker_next + 1) % LA_REASM_GAP_MARKER_CNT;
+}
+
+// Records the gap between the last fragment of a recently expired adaptive
+// entry and the given fragment of the same message (if there is such an entry).
+// Markers are matched by the key hash and the timeout class. A hash collision
+// may at worst produce a single spurious sample.
+static void la_reasm_gap_marker_match(la_reasm_shard *shard, la_reasm_fragment_info const *finfo,
+		uint32_t key_hash) {
+	if(shard->gap_markers == NULL) {
+		return;
+	}
+	// Start from the most recent marker
+	for(size_t i = 1; i <= LA_REASM_GAP_MARKER_CNT; i++) {
+		la_reasm_gap_marker *marker = shard->gap_markers +
+			(shard->gap_marker_next + LA_REASM_GAP_MARKER_CNT - i) % LA_REASM_GAP_MARKER_CNT;
+		if(marker->key_hash != key_hash || marker->timeout_class != finfo->timeout_class ||
+				(marker->drop_time.tv_sec == 0 && marker->drop_time.tv_usec == 0)) {
+			continue;
+		}
+		if(!la_reasm_timeval_after(finfo->rx_time, marker->drop_time)) {
+			la_debug_print(D_INFO, "fragment of an expired adaptive entry, recording the gap\n");
+			la_reasm_gap_record(shard, marker->timeout_class, marker->last_frag_rx_time,
+					finfo->rx_time);
+		}
+		marker->drop_time = (struct timeval){ 0 };
+		return;
+	}
+}
+
+// Computes the expiry deadline of the entry
+static struct timeval la_reasm_entry_deadline(la_reasm_table_entry const *rt_entry) {
+	struct timeval deadline = la_reasm_deadline(rt_entry->first_frag_rx_time, rt_entry->reasm_timeout);
+	if(rt_entry->adaptive_timeout) {
+		struct timeval gap_deadline = la_reasm_deadline(rt_entry->last_frag_rx_time,
+				rt_entry->gap_timeout);
+		if(la_reasm_timeval_after(deadline, gap_deadline)) {
+			deadline = gap_deadline;
+		}
+	}
+	return deadline;
+}
+
+// Passes the contents of an expired, incomplete entry to the expiry callback.
+// The fragments of the entry must already be sorted.
+static void la_reasm_entry_expiry_report(la_reasm_table_entry const *rt_entry,
+		la_reasm_expire_func *cb, void *cb_ctx) {
+	la_reasm_table const *rtable = rt_entry->rtable;
+	la_assert(rt_entry->fragments_sorted);
+	la_reasm_partial_fragment *fragments = NULL;
+	int gap_cnt = 0;
+	if(rt_entry->frags_collected_cnt > 0) {
+		fragments = LA_HEAP_XCALLOC(rt_entry->frags_collected_cnt, sizeof(la_reasm_partial_fragment));
+	}
+	for(int i = 0; i < rt_entry->frags_collected_cnt; i++) {
+		la_reasm_fragment const *frag = rt_entry->fragments + i;
+		// Sequence numbers of consecutive fragments differ by one, unless
+		// some fragments are missing or the sequence number has wrapped to 0.
+		bool gap_before = i > 0 && frag->seq_num != fragments[i-1].seq_num + 1 &&
+			!(frag->seq_num == 0 && fragments[i-1].seq_num > 0);
+		fragments[i] = (la_reasm_partial_fragment){
+			.seq_num = frag->seq_num,
+			.data = rt_entry->payload + frag->offset,
+			.len = frag->len,
+			.gap_before = gap_before
+		};
+		gap_cnt += gap_before;
+	}
+	la_reasm_expiry_info info = {
+		.table_id = rtable->key,
+		.key = rt_entry->key,
+		.first_frag_rx_time = rt_entry->first_frag_rx_time,
+		.total_pdu_len = rt_entry->total_pdu_len,
+		.total_fragment_cnt = rt_entry->total_fragment_cnt,
+		.frags_collected_cnt = rt_entry->frags_collected_cnt,
+		.frags_collected_total_len = rt_entry->frags_collected_total_len,
+		.gap_cnt = gap_cnt,
+		.payload = rt_entry->payload,
+		.fragments = fragments
+	};
+	cb(&info, cb_ctx);
+	LA_XFREE(fragments);
+}
+
+// Moves the contents of an expired entry to a new la_reasm_expired_entry
+// and prepends it to the list. The key, the payload and the fragment index
+// are taken away from the table entry, so the entry may then be removed
+// from the table as usual.
+static void la_reasm_entry_detach(la_reasm_table_entry *rt_entry, la_reasm_expired_entry **list) {
+	la_reasm_fragments_sort(rt_entry);
+	la_reasm_expired_entry *expired = LA_HEAP_XCALLOC(1, sizeof(la_reasm_expired_entry));
+	expired->entry = *rt_entry;
+	expired->entry.seq_bitmap = NULL;
+	expired->cb = rt_entry->rtable->expire_cb;
+	expired->cb_ctx = rt_entry->rtable->expire_cb_ctx;
+	expired->next = *list;
+	*list = expired;
+	rt_entry->key = NULL;
+	rt_entry->payload = NULL;
+	rt_entry->fragments = NULL;
+}
+
+// Reports the detached entries to their expiry callbacks and frees them.
+// This is done without holding any locks, so that the callbacks may use
+// the reassembly context.
+static void la_reasm_expired_entries_report(la_reasm_expired_entry *list) {
+	// Entries have been prepended to the list, so reverse it
+	// to report them in the order of expiry.
+	la_reasm_expired_entry *reversed = NULL;
+	while(list != NULL) {
+		la_reasm_expired_entry *next = list->next;
+		list->next = reversed;
+		reversed = list;
+		list = next;
+	}
+	list = reversed;
+	while(list != NULL) {
+		la_reasm_expired_entry *next = list->next;
+		la_reasm_table_entry *rt_entry = &list->entry;
+		la_reasm_entry_expiry_report(rt_entry, list->cb, list->cb_ctx);
+		if(rt_entry->rtable->funcs.destroy_key != NULL) {
+			rt_entry->rtable->funcs.destroy_key(rt_entry->key);
+		}
+		LA_XFREE(rt_entry->payload);
+		LA_XFREE(rt_entry->fragments);
+		LA_XFREE(list);
+		list = next;
+	}
+}
+
+// Removes expired entries from the given reassembly table shard.
+// Only the entries which have actually expired are touched. Incomplete
+// entries of tables with an expiry callback are detached and prepended
+// to *expired, to be reported after the shard has been unlocked.
+// Returns the number of entries removed.
+static size_t la_reasm_shard_cleanup(la_reasm_shard *shard, struct timeval now,
+		la_reasm_expired_entry **expired) {
+	la_assert(shard != NULL);
+	la_assert(shard->fragment_table != NULL);
+	size_t deleted_count = 0;
+	while(shard->expiry_heap_len > 0 &&
+			la_reasm_timeval_after(now, shard->expiry_heap[0]->deadline)) {
+		la_reasm_table_entry *rt_entry = shard->expiry_heap[0];
+		la_debug_print(D_INFO, "deadline: %lu.%lu now: %lu.%lu\n",
+				rt_entry->deadline.tv_sec, rt_entry->deadline.tv_usec, now.tv_sec, now.tv_usec);
+		// The key is still valid after detaching (it's owned by the detached copy)
+		void *key = rt_entry->key;
+		if(rt_entry->adaptive_timeout && !rt_entry->complete &&
+				la_reasm_timeval_after(la_reasm_deadline(rt_entry->first_frag_rx_time,
+					rt_entry->reasm_timeout), rt_entry->deadline)) {
+			la_reasm_gap_marker_add(shard, rt_entry);
+		}
+		if(rt_entry->rtable->expire_cb != NULL && !rt_entry->complete) {
+			la_reasm_entry_detach(rt_entry, expired);
+		}
+		// This removes the entry from the heap as well
+		la_hash_remove_with_hash(shard->fragment_table, key, rt_entry->key_hash);
+		deleted_count++;
+	}
+	shard->stats.expired_cnt += deleted_count;
+	la_debug_print(D_INFO, "Expired %zu entries\n", deleted_count);
+	return deleted_count;
+}
+
+// Removes expired entries from all reassembly tables in the context.
+// This is normally done when a fragment is added to the table, however
+// tables which do not receive any new fragments would hold expired
+// entries indefinitely. This function may be called periodically
+// to prevent this. Returns the number of entries removed.
+size_t la_reasm_ctx_expire(la_reasm_ctx *rctx, struct timeval now) {
+	la_assert(rctx != NULL);
+	LA_ALLOC_MODULE_ENTER(LA_ALLOC_MODULE_REASSEMBLY);
+	size_t deleted_count = 0;
+	la_reasm_rtables_rdlock(rctx);
+	la_reasm_expired_entry *expired = NULL;
+	for(size_t t = 0; t < rctx->rtables->len; t++) {
+		la_reasm_table *rtable = rctx->rtables->items[t];
+		for(size_t i = 0; i < rctx->shard_cnt; i++) {
+			la_reasm_shard *shard = rtable->shards + i;
+			la_reasm_ctx_shard_lock(shard->ctx_shard);
+			deleted_count += la_reasm_shard_cleanup(shard, now, &expired);
+			la_reasm_ctx_shard_unlock(shard->ctx_shard);
+		}
+	}
+	la_reasm_rtables_unlock(rctx);
+	la_reasm_expired_entries_report(expired);
+	LA_ALLOC_MODULE_LEAVE();
+	return deleted_count;
+}
+
+static void la_reasm_table_expiry_cb_apply(la_reasm_table *rtable,
+		la_reasm_expire_func *cb, void *cb_ctx) {
+	for(size_t i = 0; i < rtable->rctx->shard_cnt; i++) {
+		la_reasm_ctx_shard_lock(rtable->shards[i].ctx_shard);
+	}
+	rtable->expire_cb = cb;
+	rtable->expire_cb_ctx = cb_ctx;
+	for(size_t i = 0; i < rtable->rctx->shard_cnt; i++) {
+		la_reasm_ctx_shard_unlock(rtable->shards[i].ctx_shard);
+	}
+}
+
+// Sets a callback which is called for each incomplete message expiring from
+// the table identified by table_id. If the table does not exist yet,
+// the callback is set when the table gets created. NULL cb removes
+// the callback.
+void la_reasm_ctx_expiry_cb_set(la_reasm_ctx *rctx, void const *table_id,
+		la_reasm_expire_func *cb, void *cb_ctx) {
+	la_assert(rctx != NULL);
+	la_assert(table_id != NULL);
 
-	la_reasm_table *rtable = la_reasm_table_lookup(rctx, table_id);
+	la_reasm_rtables_wrlock(rctx);
+	la_reasm_expiry_cb_binding *binding = NULL;
+	for(size_t i = 0; i < rctx->expiry_cbs->len; i++) {
+		la_reasm_expiry_cb_binding *b = rctx->expiry_cbs->items[i];
+		if(b->table_id == table_id) {
+			binding = b;
+			break;
+		}
+	}
+	if(binding == NULL) {
+		binding = LA_HEAP_XCALLOC(1, sizeof(la_reasm_expiry_cb_binding));
+		binding->table_id = table_id;
+		la_vec_append(rctx->expiry_cbs, binding);
+	}
+	binding->cb = cb;
+	binding->cb_ctx = cb_ctx;
+	la_reasm_table *rtable = la_reasm_table_find(rctx, table_id);
 	if(rtable != NULL) {
-		goto end;
+		la_reasm_table_expiry_cb_apply(rtable, cb, cb_ctx);
 	}
-	rtable = LA_XCALLOC(1, sizeof(la_reasm_table));
-	rtable->key = table_id;
-	rtable->fragment_table = la_hash_new(funcs.hash_key, funcs.compare_keys,
-			funcs.destroy_key, la_reasm_table_entry_destroy);
-	rtable->funcs = funcs;
+	la_reasm_rtables_unlock(rctx);
+}
 
-	// Replace insane values with reasonable default
-	rtable->cleanup_interval = cleanup_interval > 0 ?
-		cleanup_interval : LA_REASM_DEFAULT_CLEANUP_INTERVAL;
-	rctx->rtables = la_list_append(rctx->rtables, rtable);
-end:
-	return rtable;
+#define SEQ_UNINITIALIZED -2
+
+// Checks if the given sequence number follows the previous one seen.
+static bool is_seq_num_in_sequence(int prev_seq_num, int cur_seq_num) {
+	return (prev_seq_num == SEQ_UNINITIALIZED || prev_seq_num + 1 == cur_seq_num);
 }
 
-// Checks if time difference between rx_first and rx_last is greater than timeout.
-static bool la_reasm_timed_out(struct timeval rx_last, struct timeval rx_first,
-		struct timeval timeout) {
-	if(timeout.tv_sec == 0 && timeout.tv_usec == 0) {
-		return false;
-	}
-	struct timeval to = {
-		.tv_sec = rx_first.tv_sec + timeout.tv_sec,
-		.tv_usec = rx_first.tv_usec + timeout.tv_usec
+/********************************************************************************
+ * Statistics
+ ********************************************************************************/
+
+static void la_reasm_stats_completion_record(la_reasm_table_entry const *rt_entry,
+		struct timeval rx_time) {
+	static long const ttc_bucket_bounds[LA_REASM_TTC_BUCKET_CNT - 1] = {
+		1, 2, 5, 10, 30, 60, 120, 300, 600, 1200
 	};
-	if(to.tv_usec > 1e9) {
-		to.tv_sec++;
-		to.tv_usec -= 1e9;
+	la_reasm_table_stats *stats = &rt_entry->shard->stats;
+	int frag_cnt = rt_entry->frags_collected_cnt;
+	stats->completed_frags_total += frag_cnt;
+	// Buckets: 1, 2, 3, 4, 5-8, 9-16, 17-32, 33+
+	int bucket = 0;
+	if(frag_cnt <= 4) {
+		bucket = LA_MAX(frag_cnt - 1, 0);
+	} else {
+		bucket = 4;
+		for(int limit = 8; frag_cnt > limit && bucket < LA_REASM_FRAGS_BUCKET_CNT - 1; limit *= 2) {
+			bucket++;
+		}
+	}
+	stats->frags_hist[bucket]++;
+
+	// Time to complete, rounded up to full microseconds
+	long long ttc_usec = (long long)(rx_time.tv_sec - rt_entry->first_frag_rx_time.tv_sec) * 1000000LL +
+		(rx_time.tv_usec - rt_entry->first_frag_rx_time.tv_usec);
+	bucket = 0;
+	while(bucket < LA_REASM_TTC_BUCKET_CNT - 1 && ttc_usec > ttc_bucket_bounds[bucket] * 1000000LL) {
+		bucket++;
 	}
-	la_debug_print(D_INFO, "rx_first: %lu.%lu to: %lu.%lu rx_last: %lu.%lu\n",
-			rx_first.tv_sec, rx_first.tv_usec, to.tv_sec, to.tv_usec, rx_last.tv_sec, rx_last.tv_usec);
-	return (rx_last.tv_sec > to.tv_sec ||
-			(rx_last.tv_sec == to.tv_sec && rx_last.tv_usec > to.tv_usec));
+	stats->ttc_hist[bucket]++;
 }
 
-// Callback for la_hash_foreach_remove used during reassembly table cleanups.
-static bool is_rt_entry_expired(void const *keyptr, void const *valptr, void *ctx) {
-	LA_UNUSED(keyptr);
-	la_assert(valptr != NULL);
-	la_assert(ctx != NULL);
+// Returns statistics of the given reassembly table.
+// Counters of all shards are summed up, so the peak values of a sharded
+// table are upper bounds rather than exact values.
+void la_reasm_table_stats_get(la_reasm_table const *rtable, la_reasm_table_stats *result) {
+	la_assert(rtable != NULL);
+	la_assert(result != NULL);
+	*result = (la_reasm_table_stats){ 0 };
+	for(size_t i = 0; i < rtable->rctx->shard_cnt; i++) {
+		la_reasm_shard const *shard = rtable->shards + i;
+		la_reasm_ctx_shard_lock(shard->ctx_shard);
+		la_reasm_table_stats const *stats = &shard->stats;
+		for(int j = 0; j <= LA_REASM_STATUS_MAX; j++) {
+			result->status_cnt[j] += stats->status_cnt[j];
+		}
+		result->expired_cnt += stats->expired_cnt;
+		result->evicted_cnt += stats->evicted_cnt;
+		result->discarded_cnt += stats->discarded_cnt;
+		result->entries += shard->usage.entries;
+		result->peak_entries += stats->peak_entries;
+		result->bytes += shard->usage.bytes;
+		result->peak_bytes += stats->peak_bytes;
+		result->completed_frags_total += stats->completed_frags_total;
+		for(int j = 0; j < LA_REASM_FRAGS_BUCKET_CNT; j++) {
+			result->frags_hist[j] += stats->frags_hist[j];
+		}
+		for(int j = 0; j < LA_REASM_TTC_BUCKET_CNT; j++) {
+			result->ttc_hist[j] += stats->ttc_hist[j];
+		}
+		la_reasm_ctx_shard_unlock(shard->ctx_shard);
+	}
+}
 
-	la_reasm_table_entry const *rt_entry = valptr;
-	struct timeval *now = ctx;
-	return la_reasm_timed_out(*now, rt_entry->first_frag_rx_time, rt_entry->reasm_timeout);
+// Returns statistics of the reassembly table identified by table_id.
+// Returns false if there is no such table in the context.
+bool la_reasm_ctx_stats_get(la_reasm_ctx *rctx, void const *table_id, la_reasm_table_stats *result) {
+	la_assert(rctx != NULL);
+	la_assert(table_id != NULL);
+	la_assert(result != NULL);
+	la_reasm_table const *rtable = la_reasm_table_lookup(rctx, table_id);
+	if(rtable == NULL) {
+		return false;
+	}
+	la_reasm_table_stats_get(rtable, result);
+	return true;
 }
 
-// Removes expired entries from the given reassembly table.
-static void la_reasm_table_cleanup(la_reasm_table *rtable, struct timeval now) {
+// Zeroes all counters and histograms of the given table.
+// Peak values are set to the current values.
+void la_reasm_table_stats_reset(la_reasm_table *rtable) {
 	la_assert(rtable != NULL);
-	la_assert(rtable->fragment_table != NULL);
-	int deleted_count = la_hash_foreach_remove(rtable->fragment_table,
-			is_rt_entry_expired, &now);
-	// Avoid compiler warning when DEBUG is off
-	LA_UNUSED(deleted_count);
-	la_debug_print(D_INFO, "Expired %d entries\n", deleted_count);
+	for(size_t i = 0; i < rtable->rctx->shard_cnt; i++) {
+		la_reasm_shard *shard = rtable->shards + i;
+		la_reasm_ctx_shard_lock(shard->ctx_shard);
+		shard->stats = (la_reasm_table_stats){
+			.peak_entries = shard->usage.entries,
+			.peak_bytes = shard->usage.bytes
+		};
+		la_reasm_ctx_shard_unlock(shard->ctx_shard);
+	}
 }
 
-#define SEQ_UNINITIALIZED -2
-
-// Checks if the given sequence number follows the previous one seen.
-static bool is_seq_num_in_sequence(int prev_seq_num, int cur_seq_num) {
-	return (prev_seq_num == SEQ_UNINITIALIZED || prev_seq_num + 1 == cur_seq_num);
+// Returns true if the fragment announces a different message length than
+// the one known for the entry. Only the total tracked by the entry is
+// compared (total_pdu_len if set, otherwise total_fragment_cnt - the latter
+// is not stored when the former is known) and only if the fragment
+// carries it.
+static bool la_reasm_entry_total_changed(la_reasm_table_entry const *rt_entry,
+		la_reasm_fragment_info const *finfo) {
+	if(rt_entry->total_pdu_len > 0) {
+		return finfo->total_pdu_len > 0 && finfo->total_pdu_len != rt_entry->total_pdu_len;
+	}
+	if(rt_entry->total_fragment_cnt > 0) {
+		return finfo->total_fragment_cnt > 0 &&
+			finfo->total_fragment_cnt != rt_entry->total_fragment_cnt;
+	}
+	return false;
 }
 
 // Core reassembly logic.
 // Validates the given message fragment and appends it to the reassembly table
-// fragment list.
-la_reasm_status la_reasm_fragment_add(la_reasm_table *rtable, la_reasm_fragment_info const *finfo) {
-	la_assert(rtable != NULL);
-	la_assert(finfo != NULL);
-	if(finfo->msg_info == NULL) {
-		return LA_REASM_ARGS_INVALID;
-	}
+// fragment list. If the message is now complete, its table entry is stored
+// in *completed. Expired entries to be reported are prepended to *expired.
+// The caller must hold the lock of the shard.
+static la_reasm_status la_reasm_fragment_process(la_reasm_table *rtable, la_reasm_shard *shard,
+		la_reasm_fragment_info const *finfo, void const *lookup_key, uint32_t key_hash,
+		la_reasm_table_entry **completed, la_reasm_expired_entry **expired) {
 
 	// Don't allow zero timeout. This would prevent stale rt_entries from being expired,
 	// causing a massive memory leak.
@@ -244,12 +1452,40 @@ la_reasm_status la_reasm_fragment_add(la_reasm_table *rtable, la_reasm_fragment_
 		return LA_REASM_ARGS_INVALID;
 	}
 
+	// Expire old entries first. If the entry for this message has timed out,
+	// it is removed here and this fragment will be treated as a part of a new
+	// message.
+	// Expiration is performed in relation to rx_time of the fragment currently
+	// being processed. This allows processing historical data with timestamps in
+	// the past.
+
+	la_reasm_shard_cleanup(shard, finfo->rx_time, expired);
+
 	la_reasm_status ret = LA_REASM_UNKNOWN;
-	void *lookup_key = rtable->funcs.get_tmp_key(finfo->msg_info);
-	la_assert(lookup_key != NULL);
-	la_reasm_table_entry *rt_entry = NULL;
-restart:
-	rt_entry = la_hash_lookup(rtable->fragment_table, lookup_key);
+	la_reasm_table_entry *rt_entry = la_hash_lookup_with_hash(shard->fragment_table,
+			lookup_key, key_hash);
+
+	// A fragment which does not start a new message might belong to a message
+	// which has expired due to the adaptive timeout. Learn the gap then.
+
+	if(rt_entry == NULL && (finfo->flags & LA_REASM_ADAPTIVE_TIMEOUT) &&
+			!(finfo->seq_num_first != SEQ_FIRST_NONE && finfo->seq_num == finfo->seq_num_first)) {
+		la_reasm_gap_marker_match(shard, finfo, key_hash);
+	}
+
+	// The sender might reuse the message identifier for a different message
+	// while the previous one is still in the table. If the caller can tell
+	// this from the message length, drop the previous message.
+
+	if(rt_entry != NULL && (finfo->flags & LA_REASM_RESTART_IF_CHANGED) &&
+			la_reasm_entry_total_changed(rt_entry, finfo)) {
+		la_debug_print(D_INFO, "total_pdu_len/total_fragment_cnt changed (%d/%d -> %d/%d), "
+				"discarding the previous message\n", rt_entry->total_pdu_len,
+				rt_entry->total_fragment_cnt, finfo->total_pdu_len, finfo->total_fragment_cnt);
+		la_hash_remove_with_hash(shard->fragment_table, rt_entry->key, key_hash);
+		shard->stats.discarded_cnt++;
+		rt_entry = NULL;
+	}
 	if(rt_entry == NULL) {
 
 		if(finfo->flags & LA_ALLOW_OUT_OF_ORDER_DELIVERY) {
@@ -287,10 +1523,24 @@ restart:
 				goto end;
 			}
 		}
-		rt_entry = LA_XCALLOC(1, sizeof(la_reasm_table_entry));
+		la_reasm_entries_limit_enforce(shard);
+		rt_entry = LA_HEAP_XCALLOC(1, sizeof(la_reasm_table_entry));
+		rt_entry->rtable = rtable;
+		rt_entry->shard = shard;
 		rt_entry->prev_seq_num = SEQ_UNINITIALIZED;
+		rt_entry->out_of_order = (finfo->flags & LA_ALLOW_OUT_OF_ORDER_DELIVERY) != 0;
+		rt_entry->fragments_sorted = true;
+		rt_entry->seq_num_first = finfo->seq_num_first;
+		rt_entry->seq_num_final = SEQ_FIRST_NONE;
 		rt_entry->first_frag_rx_time = finfo->rx_time;
+		rt_entry->last_frag_rx_time = finfo->rx_time;
 		rt_entry->reasm_timeout = finfo->reasm_timeout;
+		if(finfo->flags & LA_REASM_ADAPTIVE_TIMEOUT) {
+			rt_entry->adaptive_timeout = true;
+			rt_entry->timeout_class = finfo->timeout_class;
+			rt_entry->gap_timeout = la_reasm_gap_timeout_get(shard, finfo->timeout_class,
+					finfo->reasm_timeout);
+		}
 		if(finfo->total_pdu_len > 0) {
 			rt_entry->total_pdu_len = finfo->total_pdu_len;
 		} else if(finfo->total_fragment_cnt > 0) {
@@ -301,9 +1551,14 @@ restart:
 		la_debug_print(D_INFO, "Adding new rt_table entry (rx_time: %lu.%lu timeout: %lu.%lu)\n",
 				rt_entry->first_frag_rx_time.tv_sec, rt_entry->first_frag_rx_time.tv_usec,
 				rt_entry->reasm_timeout.tv_sec, rt_entry->reasm_timeout.tv_usec);
-		void *msg_key = rtable->funcs.get_key(finfo->msg_info);
-		la_assert(msg_key != NULL);
-		la_hash_insert(rtable->fragment_table, msg_key, rt_entry);
+		rt_entry->deadline = la_reasm_entry_deadline(rt_entry);
+		rt_entry->key = rtable->funcs.get_key(finfo->msg_info);
+		la_assert(rt_entry->key != NULL);
+		rt_entry->key_hash = key_hash;
+		la_reasm_expiry_heap_push(shard, rt_entry);
+		la_reasm_usage_add(rt_entry);
+		la_reasm_usage_update(rt_entry);
+		la_hash_insert_with_hash(shard->fragment_table, rt_entry->key, rt_entry, key_hash);
 	} else {
 		la_debug_print(D_INFO, "rt_entry found, prev_seq_num: %d\n", rt_entry->prev_seq_num);
 	}
@@ -321,23 +1576,11 @@ restart:
 		rt_entry->prev_seq_num = -1;
 	}
 
-	// Check reassembly timeout
-
-	if(la_reasm_timed_out(finfo->rx_time, rt_entry->first_frag_rx_time, rt_entry->reasm_timeout) == true) {
-
-		// If reassembly timeout has expired, we treat this fragment as a part of
-		// a new message. Remove the old rt_entry and create new one.
-
-		la_debug_print(D_INFO, "reasm timeout expired; creating new rt_entry\n");
-		la_hash_remove(rtable->fragment_table, lookup_key);
-		goto restart;
-	}
-
 	// Skip duplicates / retransmissions.
 
 	bool is_duplicate = false;
 	if(finfo->flags & LA_ALLOW_OUT_OF_ORDER_DELIVERY) {
-		is_duplicate = la_reasm_fragment_seq_num_already_exists(rt_entry->fragment_list, finfo->seq_num);
+		is_duplicate = la_reasm_fragment_seq_num_already_exists(rt_entry, finfo->seq_num);
 	} else {
 		// If out-of-order delivery is not allowed, then we may use a simplified
 		// check for duplicates.
@@ -361,22 +1604,37 @@ restart:
 
 		la_debug_print(D_INFO, "seq_num %d out of sequence (prev: %d)\n",
 				finfo->seq_num, rt_entry->prev_seq_num);
-		la_hash_remove(rtable->fragment_table, lookup_key);
+		la_hash_remove_with_hash(shard->fragment_table, rt_entry->key, key_hash);
 		ret = LA_REASM_FRAG_OUT_OF_SEQUENCE;
 		goto end;
 	}
 
-	// All checks succeeded. Add the fragment to the list.
-	// If out-of-order delivery is allowed, keep the fragment list sorted by seq_num.
-	// Otherwise just append it at the end of the list - this is simpler and also
-	// works correctly if seq_num may wrap - sorted insert wouldn't work then.
+	// Don't let a single message grow indefinitely.
+
+	la_reasm_limits const *limits = la_reasm_fragments_limit_check(rt_entry, 1);
+	if(limits != NULL) {
+		la_reasm_entry_evict(rt_entry, limits, LA_REASM_EVICT_MAX_FRAGMENTS);
+		ret = LA_REASM_LIMIT_EXCEEDED;
+		goto end;
+	}
+
+	// All checks succeeded. Store the fragment.
+	// Fragments are always appended at the end. If out-of-order delivery is
+	// allowed, they get sorted by seq_num once the message is complete.
+	// Otherwise they are in order already (this also works correctly if
+	// seq_num may wrap - sorting wouldn't work then).
 
-	la_reasm_fragment *fragment = la_reasm_fragment_new(finfo->seq_num, finfo->msg_data, finfo->msg_data_len);
 	if(finfo->flags & LA_ALLOW_OUT_OF_ORDER_DELIVERY) {
-		la_debug_print(D_INFO, "Good seq_num %d, adding fragment to the list\n",
+		la_debug_print(D_INFO, "Good seq_num %d, adding fragment\n",
 				finfo->seq_num);
-		rt_entry->fragment_list = la_list_insert_sorted(rt_entry->fragment_list, fragment,
-				la_reasm_compare_fragment_seq_numbers);
+		la_reasm_fragment_store(rt_entry, finfo->seq_num, finfo->msg_data, finfo->msg_data_len);
+		la_reasm_seq_num_track(rt_entry, finfo->seq_num);
+		if(finfo->is_final_fragment) {
+			rt_entry->seq_num_final = finfo->seq_num;
+		}
+		if(rt_entry->seq_num_first == SEQ_FIRST_NONE) {
+			rt_entry->seq_num_first = finfo->seq_num_first;
+		}
 		// total_pdu_len or total_fragment_cnt values might be contained in the
 		// first fragment only (like msg_total attribute in OHMA). If the first
 		// fragment received was not the first fragment of the message, then
@@ -389,13 +1647,21 @@ restart:
 			rt_entry->total_fragment_cnt = finfo->total_fragment_cnt;
 		}
 	} else {
-		la_debug_print(D_INFO, "Good seq_num %d (prev: %d), adding fragment to the list\n",
+		la_debug_print(D_INFO, "Good seq_num %d (prev: %d), adding fragment\n",
 				finfo->seq_num, rt_entry->prev_seq_num);
-			rt_entry->fragment_list = la_list_append(rt_entry->fragment_list, fragment);
+		la_reasm_fragment_store(rt_entry, finfo->seq_num, finfo->msg_data, finfo->msg_data_len);
 		rt_entry->prev_seq_num = finfo->seq_num;
 	}
-	rt_entry->frags_collected_total_len += finfo->msg_data_len;
-	rt_entry->frags_collected_cnt++;
+
+	// Learn the gap since the previous fragment and push the deadline forward.
+
+	if(rt_entry->adaptive_timeout && rt_entry->frags_collected_cnt > 1) {
+		la_reasm_gap_record(shard, rt_entry->timeout_class,
+				rt_entry->last_frag_rx_time, finfo->rx_time);
+		rt_entry->last_frag_rx_time = finfo->rx_time;
+		rt_entry->deadline = la_reasm_entry_deadline(rt_entry);
+		la_reasm_expiry_heap_update(shard, rt_entry);
+	}
 
 	// If we've come to this point successfully, then reassembly is complete if:
 	//
@@ -410,37 +1676,155 @@ restart:
 	//
 	// Otherwise we expect more fragments to come.
 	//
-	// XXX: when out-of-order delivery is allowed, we probably should verify
-	// whether seq_nums of collected fragments form a contiguous sequence,
-	// however the only protocol which currently uses this mode of reassembly
-	// is OHMA, for which total_fragment_cnt check is good enough.
+	// When out-of-order delivery is allowed, the final fragment is not
+	// necessarily the last one to arrive, hence the final fragment condition
+	// becomes "the final fragment has been received". In addition, seq_nums
+	// of collected fragments must form a contiguous sequence starting from
+	// seq_num_first (if it is known).
 
+	bool complete = false;
 	if(rt_entry->total_pdu_len > 0) {
-		ret = rt_entry->frags_collected_total_len >= rt_entry->total_pdu_len ?
-			LA_REASM_COMPLETE : LA_REASM_IN_PROGRESS;
+		complete = rt_entry->frags_collected_total_len >= rt_entry->total_pdu_len;
 	} else if(rt_entry->total_fragment_cnt > 0) {
-		ret = rt_entry->frags_collected_cnt >= rt_entry->total_fragment_cnt ?
-			LA_REASM_COMPLETE : LA_REASM_IN_PROGRESS;
+		complete = rt_entry->frags_collected_cnt >= rt_entry->total_fragment_cnt;
+	} else if(finfo->flags & LA_ALLOW_OUT_OF_ORDER_DELIVERY) {
+		complete = rt_entry->seq_num_final != SEQ_FIRST_NONE &&
+			rt_entry->seq_num_max == rt_entry->seq_num_final;
 	} else {
-		ret = finfo->is_final_fragment ? LA_REASM_COMPLETE : LA_REASM_IN_PROGRESS;
+		complete = finfo->is_final_fragment;
+	}
+	if(complete && (finfo->flags & LA_ALLOW_OUT_OF_ORDER_DELIVERY)) {
+		complete = la_reasm_fragments_contiguous(rt_entry);
+	}
+	ret = complete ? LA_REASM_COMPLETE : LA_REASM_IN_PROGRESS;
+	if(ret == LA_REASM_COMPLETE) {
+		la_reasm_fragments_sort(rt_entry);
+		rt_entry->complete = true;
+		la_reasm_stats_completion_record(rt_entry, finfo->rx_time);
+		*completed = rt_entry;
+	}
+
+	// Enforce memory limits. Complete messages are exempt from this, as
+	// the caller is expected to retrieve them (and thus release the memory)
+	// right away.
+
+	la_reasm_usage_update(rt_entry);
+	la_reasm_lru_touch(rt_entry);
+	if(ret == LA_REASM_IN_PROGRESS) {
+		limits = la_reasm_bytes_limit_enforce(rt_entry);
+		if(limits != NULL) {
+			la_reasm_entry_evict(rt_entry, limits, LA_REASM_EVICT_MAX_BYTES);
+			ret = LA_REASM_LIMIT_EXCEEDED;
+		}
 	}
 
 end:
+	la_debug_print(D_INFO, "Result: %d\n", ret);
+	return ret;
+}
 
-	// Update fragment counter and expire old entries if necessary.
-	// Expiration is performed in relation to rx_time of the fragment currently
-	// being processed. This allows processing historical data with timestamps in
-	// the past.
+// Hands the reassembled payload of the given entry over to the caller
+// and removes the entry from the table. Returns the payload length.
+// If the payload is empty, *result is not touched. The caller must hold
+// the lock of the shard.
+static int la_reasm_payload_take(la_reasm_shard *shard, la_reasm_table_entry *rt_entry,
+		uint32_t key_hash, uint8_t **result) {
+	int result_len = rt_entry->frags_collected_total_len;
+	if(result_len > 0) {
+		// The payload is already stored contiguously, so the buffer is handed
+		// over to the caller as is. Append a NULL byte at the end, so that it
+		// can be cast to char * if this is a text message (payload_reserve()
+		// always leaves room for it).
+		rt_entry->payload[rt_entry->frags_collected_total_len] = '\0';
+		if(la_arena_get() != NULL) {
+			// The caller decodes into an arena, so the result must come from
+			// the arena too, to be released together with the decoded message.
+			*result = LA_XCALLOC(result_len + 1, sizeof(uint8_t));
+			memcpy(*result, rt_entry->payload, result_len + 1);
+		} else {
+			*result = rt_entry->payload;
+			rt_entry->payload = NULL;
+		}
+	} else {
+		result_len = 0;
+	}
+	la_hash_remove_with_hash(shard->fragment_table, rt_entry->key, key_hash);
+	return result_len;
+}
+
+// Adds the fragment to the table. If result is not NULL and the fragment
+// completes the message, the reassembled payload is taken from the table
+// in the same locked section (see la_reasm_fragment_add_and_reassemble).
+static la_reasm_status la_reasm_fragment_add_internal(la_reasm_table *rtable,
+		la_reasm_fragment_info const *finfo, uint8_t **result, int *result_len) {
+	la_assert(rtable != NULL);
+	la_assert(finfo != NULL);
 
-	if(++rtable->frag_cnt > rtable->cleanup_interval) {
-		la_reasm_table_cleanup(rtable, finfo->rx_time);
-		rtable->frag_cnt = 0;
+	la_reasm_shard *shard = NULL;
+	la_reasm_status ret = LA_REASM_UNKNOWN;
+	// key_hash and timeout_class share storage
+	bool const flags_conflict = (finfo->flags & LA_REASM_KEY_HASH_SET) &&
+		(finfo->flags & LA_REASM_ADAPTIVE_TIMEOUT);
+	if(finfo->msg_info == NULL || flags_conflict) {
+		shard = rtable->shards;
+		ret = LA_REASM_ARGS_INVALID;
+		la_reasm_ctx_shard_lock(shard->ctx_shard);
+		shard->stats.status_cnt[ret]++;
+		la_reasm_ctx_shard_unlock(shard->ctx_shard);
+		return ret;
 	}
-	la_debug_print(D_INFO, "Result: %d\n", ret);
-	LA_XFREE(lookup_key);
+
+	// Use the key supplied by the caller, if any. Otherwise build
+	// a temporary one from msg_info. In either case compute the hash
+	// only once (unless the caller has done it for us). This is done
+	// before taking the lock, as the hash determines the shard.
+
+	LA_ALLOC_MODULE_ENTER(LA_ALLOC_MODULE_REASSEMBLY);
+	void *allocated_key = NULL;
+	void const *lookup_key = finfo->tmp_key;
+	if(lookup_key == NULL) {
+		lookup_key = allocated_key = rtable->funcs.get_tmp_key(finfo->msg_info);
+	}
+	la_assert(lookup_key != NULL);
+	uint32_t key_hash = finfo->flags & LA_REASM_KEY_HASH_SET ?
+		finfo->key_hash : rtable->funcs.hash_key(lookup_key);
+
+	shard = la_reasm_shard_get(rtable, key_hash);
+	la_reasm_ctx_shard_lock(shard->ctx_shard);
+	la_reasm_table_entry *completed = NULL;
+	la_reasm_expired_entry *expired = NULL;
+	ret = la_reasm_fragment_process(rtable, shard, finfo, lookup_key, key_hash,
+			&completed, &expired);
+	shard->stats.status_cnt[ret]++;
+	if(completed != NULL && result != NULL) {
+		*result_len = la_reasm_payload_take(shard, completed, key_hash, result);
+	}
+	la_reasm_ctx_shard_unlock(shard->ctx_shard);
+	la_reasm_expired_entries_report(expired);
+
+	LA_XFREE(allocated_key);
+	LA_ALLOC_MODULE_LEAVE();
 	return ret;
 }
 
+la_reasm_status la_reasm_fragment_add(la_reasm_table *rtable, la_reasm_fragment_info const *finfo) {
+	return la_reasm_fragment_add_internal(rtable, finfo, NULL, NULL);
+}
+
+// Same as la_reasm_fragment_add(), but if the fragment completes the message,
+// the reassembled payload is returned in *result and its length in *result_len
+// and the message is removed from the table, as if la_reasm_payload_get() has
+// been called. In any other case *result is left intact and *result_len is
+// set to -1. This saves the second table lookup and guarantees that another
+// thread can't take the payload first.
+la_reasm_status la_reasm_fragment_add_and_reassemble(la_reasm_table *rtable,
+		la_reasm_fragment_info const *finfo, uint8_t **result, int *result_len) {
+	la_assert(result != NULL);
+	la_assert(result_len != NULL);
+	*result_len = -1;
+	return la_reasm_fragment_add_internal(rtable, finfo, result, result_len);
+}
+
 // Returns the reassembled payload and removes the packet data from reassembly table
 int la_reasm_payload_get(la_reasm_table *rtable, void const *msg_info, uint8_t **result) {
 	la_assert(rtable != NULL);
@@ -449,37 +1833,612 @@ int la_reasm_payload_get(la_reasm_table *rtable, void const *msg_info, uint8_t *
 
 	void *tmp_key = rtable->funcs.get_tmp_key(msg_info);
 	la_assert(tmp_key);
+	int result_len = la_reasm_payload_get_with_key(rtable, tmp_key,
+			rtable->funcs.hash_key(tmp_key), result);
+	LA_XFREE(tmp_key);
+	return result_len;
+}
+
+// Same as la_reasm_payload_get(), but the entry is looked up using the key
+// and its hash value supplied by the caller, so no temporary key is allocated.
+int la_reasm_payload_get_with_key(la_reasm_table *rtable, void const *tmp_key,
+		uint32_t key_hash, uint8_t **result) {
+	la_assert(rtable != NULL);
+	la_assert(tmp_key != NULL);
+	la_assert(result != NULL);
 
-	size_t result_len = -1;
-	la_reasm_table_entry *rt_entry = la_hash_lookup(rtable->fragment_table, tmp_key);
+	LA_ALLOC_MODULE_ENTER(LA_ALLOC_MODULE_REASSEMBLY);
+	la_reasm_shard *shard = la_reasm_shard_get(rtable, key_hash);
+	int result_len = -1;
+	la_reasm_ctx_shard_lock(shard->ctx_shard);
+	la_reasm_table_entry *rt_entry = la_hash_lookup_with_hash(shard->fragment_table,
+			tmp_key, key_hash);
 	if(rt_entry == NULL) {
-		result_len = -1;
 		goto end;
 	}
 	if(rt_entry->frags_collected_total_len < 1) {
 		result_len = 0;
 		goto end;
 	}
-	// Append a NULL byte at the end of the reassembled buffer, so that it can be
-	// cast to char * if this is a text message.
-	uint8_t *reasm_buf = LA_XCALLOC(rt_entry->frags_collected_total_len + 1, sizeof(uint8_t));
-	uint8_t *ptr = reasm_buf;
-	for(la_list *l = rt_entry->fragment_list; l != NULL; l = la_list_next(l)) {
-		la_reasm_fragment *fragment = l->data;
-		if(fragment->payload.buf != NULL && fragment->payload.len > 0) {
-			memcpy(ptr, fragment->payload.buf, fragment->payload.len);
-		}
-		ptr += fragment->payload.len;
-	}
-	reasm_buf[rt_entry->frags_collected_total_len] = '\0'; // buffer len is frags_collected_total_len + 1
-	*result = reasm_buf;
-	result_len = rt_entry->frags_collected_total_len;
-	la_hash_remove(rtable->fragment_table, tmp_key);
+	result_len = la_reasm_payload_take(shard, rt_entry, key_hash, result);
 end:
-	LA_XFREE(tmp_key);
+	la_reasm_ctx_shard_unlock(shard->ctx_shard);
+	LA_ALLOC_MODULE_LEAVE();
 	return result_len;
 }
 
+// Removes the given message from the reassembly table without retrieving
+// its payload (eg. when the sender has aborted the transmission).
+// Returns true if the message has been found in the table.
+bool la_reasm_payload_discard(la_reasm_table *rtable, void const *msg_info) {
+	la_assert(rtable != NULL);
+	la_assert(msg_info != NULL);
+
+	void *tmp_key = rtable->funcs.get_tmp_key(msg_info);
+	la_assert(tmp_key);
+	bool result = la_reasm_payload_discard_with_key(rtable, tmp_key,
+			rtable->funcs.hash_key(tmp_key));
+	LA_XFREE(tmp_key);
+	return result;
+}
+
+// Same as la_reasm_payload_discard(), but the entry is looked up using the key
+// and its hash value supplied by the caller.
+bool la_reasm_payload_discard_with_key(la_reasm_table *rtable, void const *tmp_key,
+		uint32_t key_hash) {
+	la_assert(rtable != NULL);
+	la_assert(tmp_key != NULL);
+
+	la_reasm_shard *shard = la_reasm_shard_get(rtable, key_hash);
+	la_reasm_ctx_shard_lock(shard->ctx_shard);
+	bool result = la_hash_remove_with_hash(shard->fragment_table, (void *)tmp_key, key_hash);
+	if(result == true) {
+		shard->stats.discarded_cnt++;
+	}
+	la_reasm_ctx_shard_unlock(shard->ctx_shard);
+	return result;
+}
+
+/********************************************************************************
+ * Snapshots
+ ********************************************************************************/
+
+// Snapshot format. All records start at 8-byte boundaries and all integers
+// are stored in host byte order, so that a snapshot mapped into memory
+// can be read in place. Snapshots are therefore not portable between hosts
+// with different byte order (this is detected with the byte order mark).
+//
+// la_reasm_snapshot_hdr
+// for each table:
+//   la_reasm_snapshot_table_hdr
+//   table name (name_len bytes)
+//   for each entry (in LRU order, least recently updated first):
+//     la_reasm_snapshot_entry_hdr
+//     serialized key (key_len bytes)
+//     la_reasm_snapshot_fragment[frags_collected_cnt]
+//     payload (payload_len bytes)
+
+#define LA_REASM_SNAPSHOT_MAGIC "LARS"
+#define LA_REASM_SNAPSHOT_VERSION 1
+#define LA_REASM_SNAPSHOT_BOM 0x01020304U
+#define LA_REASM_SNAPSHOT_ALIGN(len) (((len) + 7) & ~(size_t)7)
+
+typedef struct {
+	char magic[4];
+	uint32_t bom;
+	uint32_t version;
+	uint32_t table_cnt;
+} la_reasm_snapshot_hdr;
+
+typedef struct {
+	uint64_t len;                       /* length of the section following
+	                                       this header (name included) */
+	uint32_t entry_cnt;
+	uint32_t name_len;
+} la_reasm_snapshot_table_hdr;
+
+typedef struct {
+	int64_t first_frag_rx_sec;
+	int64_t first_frag_rx_usec;
+	int64_t reasm_timeout_sec;
+	int64_t reasm_timeout_usec;
+	int64_t last_frag_rx_sec;
+	int64_t last_frag_rx_usec;
+	int64_t gap_timeout_sec;
+	int64_t gap_timeout_usec;
+	int32_t prev_seq_num;
+	int32_t total_pdu_len;
+	int32_t total_fragment_cnt;
+	int32_t frags_collected_cnt;
+	int32_t payload_len;
+	uint32_t key_len;
+	uint32_t flags;                     /* LA_REASM_SNAPSHOT_ENTRY_* */
+	int32_t seq_num_first;
+	int32_t seq_num_final;
+	uint32_t timeout_class;
+} la_reasm_snapshot_entry_hdr;
+
+#define LA_REASM_SNAPSHOT_ENTRY_OUT_OF_ORDER (1 << 0)
+#define LA_REASM_SNAPSHOT_ENTRY_COMPLETE (1 << 1)
+#define LA_REASM_SNAPSHOT_ENTRY_ADAPTIVE_TIMEOUT (1 << 2)
+
+typedef struct {
+	int32_t seq_num;
+	int32_t offset;
+	int32_t len;
+} la_reasm_snapshot_fragment;
+
+// Upper bound for reassembly and gap timeouts of restored entries. Actual
+// timeouts are at most several minutes long.
+#define LA_REASM_SNAPSHOT_TIMEOUT_MAX_SEC 86400
+
+// Largest timestamp of a restored entry for which la_reasm_deadline() does
+// not overflow time_t (assumed to be a signed type of 32 or 64 bits).
+#define LA_REASM_SNAPSHOT_TIME_MAX_SEC \
+	((sizeof(time_t) == 4 ? (int64_t)INT32_MAX : INT64_MAX) - LA_REASM_SNAPSHOT_TIMEOUT_MAX_SEC - 1)
+
+typedef struct {
+	uint8_t *buf;
+	size_t len;
+	size_t size;
+} la_reasm_snapshot_writer;
+
+// Appends len bytes to the snapshot (with padding up to the next record
+// boundary). If data is NULL, zeroed space is reserved, to be filled in
+// by the caller. Returns the offset of the data in the buffer.
+static size_t la_reasm_snapshot_write(la_reasm_snapshot_writer *w, void const *data, size_t len) {
+	size_t padded_len = LA_REASM_SNAPSHOT_ALIGN(len);
+	if(w->len + padded_len > w->size) {
+		w->size = LA_MAX(2 * w->size, w->len + padded_len);
+		w->buf = LA_HEAP_XREALLOC(w->buf, w->size);
+	}
+	size_t offset = w->len;
+	if(data == NULL) {
+		len = 0;
+	} else if(len > 0) {
+		memcpy(w->buf + offset, data, len);
+	}
+	memset(w->buf + offset + len, 0, padded_len - len);
+	w->len += padded_len;
+	return offset;
+}
+
+typedef struct {
+	uint8_t const *buf;
+	size_t len;
+	size_t pos;
+} la_reasm_snapshot_reader;
+
+// Returns a pointer to the next len bytes of the snapshot and skips them
+// (along with the padding). Returns NULL if the snapshot is truncated.
+static uint8_t const *la_reasm_snapshot_read(la_reasm_snapshot_reader *r, size_t len) {
+	if(len > r->len - r->pos) {
+		return NULL;
+	}
+	uint8_t const *ptr = r->buf + r->pos;
+	r->pos = LA_MIN(r->len, r->pos + LA_REASM_SNAPSHOT_ALIGN(len));
+	return ptr;
+}
+
+// Records are copied out of the buffer, since the caller's buffer
+// is not guaranteed to be suitably aligned.
+#define LA_REASM_SNAPSHOT_READ_RECORD(r, rec) \
+	la_reasm_snapshot_read_record((r), &(rec), sizeof(rec))
+
+static bool la_reasm_snapshot_read_record(la_reasm_snapshot_reader *r, void *rec, size_t len) {
+	uint8_t const *ptr = la_reasm_snapshot_read(r, len);
+	if(ptr == NULL) {
+		return false;
+	}
+	memcpy(rec, ptr, len);
+	return true;
+}
+
+static void la_reasm_snapshot_entry_write(la_reasm_snapshot_writer *w,
+		la_reasm_table const *rtable, la_reasm_table_entry *rt_entry,
+		uint8_t **key_buf, size_t *key_buf_size) {
+	la_reasm_fragments_sort(rt_entry);
+	size_t key_len = rtable->codec.serialize_key(rt_entry->key, *key_buf, *key_buf_size);
+	if(key_len > *key_buf_size) {
+		*key_buf = LA_HEAP_XREALLOC(*key_buf, key_len);
+		*key_buf_size = key_len;
+		key_len = rtable->codec.serialize_key(rt_entry->key, *key_buf, *key_buf_size);
+		la_assert(key_len <= *key_buf_size);
+	}
+	la_reasm_snapshot_entry_hdr hdr = {
+		.first_frag_rx_sec = rt_entry->first_frag_rx_time.tv_sec,
+		.first_frag_rx_usec = rt_entry->first_frag_rx_time.tv_usec,
+		.reasm_timeout_sec = rt_entry->reasm_timeout.tv_sec,
+		.reasm_timeout_usec = rt_entry->reasm_timeout.tv_usec,
+		.last_frag_rx_sec = rt_entry->last_frag_rx_time.tv_sec,
+		.last_frag_rx_usec = rt_entry->last_frag_rx_time.tv_usec,
+		.gap_timeout_sec = rt_entry->gap_timeout.tv_sec,
+		.gap_timeout_usec = rt_entry->gap_timeout.tv_usec,
+		.prev_seq_num = rt_entry->prev_seq_num,
+		.total_pdu_len = rt_entry->total_pdu_len,
+		.total_fragment_cnt = rt_entry->total_fragment_cnt,
+		.frags_collected_cnt = rt_entry->frags_collected_cnt,
+		.payload_len = rt_entry->frags_collected_total_len,
+		.key_len = (uint32_t)key_len,
+		.flags = (rt_entry->out_of_order ? LA_REASM_SNAPSHOT_ENTRY_OUT_OF_ORDER : 0) |
+			(rt_entry->complete ? LA_REASM_SNAPSHOT_ENTRY_COMPLETE : 0) |
+			(rt_entry->adaptive_timeout ? LA_REASM_SNAPSHOT_ENTRY_ADAPTIVE_TIMEOUT : 0),
+		.seq_num_first = rt_entry->seq_num_first,
+		.seq_num_final = rt_entry->seq_num_final,
+		.timeout_class = rt_entry->timeout_class
+	};
+	la_reasm_snapshot_write(w, &hdr, sizeof(hdr));
+	la_reasm_snapshot_write(w, *key_buf, key_len);
+	size_t frags_len = rt_entry->frags_collected_cnt * sizeof(la_reasm_snapshot_fragment);
+	size_t offset = la_reasm_snapshot_write(w, NULL, frags_len);
+	la_reasm_snapshot_fragment *frags = (la_reasm_snapshot_fragment *)(w->buf + offset);
+	for(int i = 0; i < rt_entry->frags_collected_cnt; i++) {
+		frags[i] = (la_reasm_snapshot_fragment){
+			.seq_num = rt_entry->fragments[i].seq_num,
+			.offset = rt_entry->fragments[i].offset,
+			.len = rt_entry->fragments[i].len
+		};
+	}
+	la_reasm_snapshot_write(w, rt_entry->payload, rt_entry->frags_collected_total_len);
+}
+
+// Serializes the state of all reassembly tables in the context which have
+// a key codec set. The snapshot is stored in a newly allocated buffer,
+// which shall be freed by the caller. Returns the length of the snapshot.
+size_t la_reasm_ctx_snapshot(la_reasm_ctx *rctx, uint8_t **result) {
+	la_assert(rctx != NULL);
+	la_assert(result != NULL);
+
+	la_reasm_snapshot_writer w = { 0 };
+	la_reasm_snapshot_hdr hdr = {
+		.magic = LA_REASM_SNAPSHOT_MAGIC,
+		.bom = LA_REASM_SNAPSHOT_BOM,
+		.version = LA_REASM_SNAPSHOT_VERSION,
+		.table_cnt = 0
+	};
+	size_t hdr_offset = la_reasm_snapshot_write(&w, &hdr, sizeof(hdr));
+	uint8_t *key_buf = NULL;
+	size_t key_buf_size = 0;
+
+	la_reasm_rtables_rdlock(rctx);
+	for(size_t t = 0; t < rctx->rtables->len; t++) {
+		la_reasm_table *rtable = rctx->rtables->items[t];
+		if(rtable->codec.name == NULL) {
+			continue;
+		}
+		la_reasm_snapshot_table_hdr thdr = {
+			.name_len = (uint32_t)strlen(rtable->codec.name)
+		};
+		size_t thdr_offset = la_reasm_snapshot_write(&w, &thdr, sizeof(thdr));
+		la_reasm_snapshot_write(&w, rtable->codec.name, thdr.name_len);
+		for(size_t i = 0; i < rctx->shard_cnt; i++) {
+			la_reasm_shard *shard = rtable->shards + i;
+			la_reasm_ctx_shard_lock(shard->ctx_shard);
+			for(la_reasm_table_entry *rt_entry = shard->usage.lru.tail; rt_entry != NULL;
+					rt_entry = rt_entry->lru[LA_REASM_LRU_TABLE].prev) {
+				la_reasm_snapshot_entry_write(&w, rtable, rt_entry, &key_buf, &key_buf_size);
+				thdr.entry_cnt++;
+			}
+			la_reasm_ctx_shard_unlock(shard->ctx_shard);
+		}
+		thdr.len = w.len - thdr_offset - sizeof(thdr);
+		memcpy(w.buf + thdr_offset, &thdr, sizeof(thdr));
+		hdr.table_cnt++;
+	}
+	la_reasm_rtables_unlock(rctx);
+
+	memcpy(w.buf + hdr_offset, &hdr, sizeof(hdr));
+	LA_XFREE(key_buf);
+	*result = w.buf;
+	return w.len;
+}
+
+// Checks whether the timestamp is not negative and is small enough
+// to compute deadlines without overflow.
+static bool la_reasm_snapshot_time_valid(int64_t sec, int64_t usec) {
+	return sec >= 0 && sec <= LA_REASM_SNAPSHOT_TIME_MAX_SEC && usec >= 0 && usec < 1000000;
+}
+
+static bool la_reasm_snapshot_timeout_valid(int64_t sec, int64_t usec) {
+	return sec >= 0 && sec <= LA_REASM_SNAPSHOT_TIMEOUT_MAX_SEC && usec >= 0 && usec < 1000000;
+}
+
+static bool la_reasm_snapshot_entry_hdr_valid(la_reasm_snapshot_entry_hdr const *hdr) {
+	return hdr->frags_collected_cnt >= 0 && hdr->payload_len >= 0 &&
+		la_reasm_snapshot_time_valid(hdr->first_frag_rx_sec, hdr->first_frag_rx_usec) &&
+		la_reasm_snapshot_time_valid(hdr->last_frag_rx_sec, hdr->last_frag_rx_usec) &&
+		la_reasm_snapshot_timeout_valid(hdr->reasm_timeout_sec, hdr->reasm_timeout_usec) &&
+		la_reasm_snapshot_timeout_valid(hdr->gap_timeout_sec, hdr->gap_timeout_usec);
+}
+
+// Fragments are written in the order of their payloads, which are stored
+// back to back. Each fragment must therefore start where the previous one
+// ends (no overlaps or holes). Sequence numbers of out-of-order entries are
+// sorted and unique; in-order entries may have wrapped seq_nums, so they are
+// not checked.
+static bool la_reasm_snapshot_fragments_valid(uint8_t const *frags, int32_t cnt,
+		int32_t payload_len, bool out_of_order) {
+	int64_t offset = 0;
+	int32_t prev_seq_num = 0;
+	for(int32_t i = 0; i < cnt; i++) {
+		la_reasm_snapshot_fragment frag;
+		memcpy(&frag, frags + i * sizeof(frag), sizeof(frag));
+		if(frag.offset != offset || frag.len < 0 || offset + frag.len > payload_len) {
+			return false;
+		}
+		if(out_of_order && i > 0 && frag.seq_num <= prev_seq_num) {
+			return false;
+		}
+		offset += frag.len;
+		prev_seq_num = frag.seq_num;
+	}
+	return offset == payload_len;
+}
+
+// Creates a table entry from its serialized form. Entries with keys already
+// present in the table are skipped (live state wins over the snapshot).
+static void la_reasm_snapshot_entry_restore(la_reasm_table *rtable,
+		la_reasm_snapshot_entry_hdr const *hdr, uint8_t const *key_data,
+		uint8_t const *frags, uint8_t const *payload) {
+	void *key = rtable->codec.deserialize_key(key_data, hdr->key_len);
+	if(key == NULL) {
+		la_debug_print(D_ERROR, "%s: failed to deserialize key, skipping entry\n",
+				rtable->codec.name);
+		return;
+	}
+	uint32_t key_hash = rtable->funcs.hash_key(key);
+	la_reasm_shard *shard = la_reasm_shard_get(rtable, key_hash);
+	la_reasm_ctx_shard_lock(shard->ctx_shard);
+	if(la_hash_lookup_with_hash(shard->fragment_table, key, key_hash) != NULL) {
+		rtable->funcs.destroy_key(key);
+		goto end;
+	}
+	la_reasm_entries_limit_enforce(shard);
+	la_reasm_table_entry *rt_entry = LA_HEAP_XCALLOC(1, sizeof(la_reasm_table_entry));
+	rt_entry->rtable = rtable;
+	rt_entry->shard = shard;
+	rt_entry->key = key;
+	rt_entry->key_hash = key_hash;
+	rt_entry->first_frag_rx_time = (struct timeval){
+		.tv_sec = hdr->first_frag_rx_sec,
+		.tv_usec = hdr->first_frag_rx_usec
+	};
+	rt_entry->reasm_timeout = (struct timeval){
+		.tv_sec = hdr->reasm_timeout_sec,
+		.tv_usec = hdr->reasm_timeout_usec
+	};
+	rt_entry->last_frag_rx_time = (struct timeval){
+		.tv_sec = hdr->last_frag_rx_sec,
+		.tv_usec = hdr->last_frag_rx_usec
+	};
+	rt_entry->gap_timeout = (struct timeval){
+		.tv_sec = hdr->gap_timeout_sec,
+		.tv_usec = hdr->gap_timeout_usec
+	};
+	rt_entry->adaptive_timeout = (hdr->flags & LA_REASM_SNAPSHOT_ENTRY_ADAPTIVE_TIMEOUT) != 0;
+	rt_entry->timeout_class = hdr->timeout_class;
+	rt_entry->deadline = la_reasm_entry_deadline(rt_entry);
+	rt_entry->prev_seq_num = hdr->prev_seq_num;
+	rt_entry->total_pdu_len = hdr->total_pdu_len;
+	rt_entry->total_fragment_cnt = hdr->total_fragment_cnt;
+	rt_entry->out_of_order = (hdr->flags & LA_REASM_SNAPSHOT_ENTRY_OUT_OF_ORDER) != 0;
+	rt_entry->complete = (hdr->flags & LA_REASM_SNAPSHOT_ENTRY_COMPLETE) != 0;
+	rt_entry->fragments_sorted = true;
+	rt_entry->seq_num_first = hdr->seq_num_first;
+	rt_entry->seq_num_final = hdr->seq_num_final;
+	la_reasm_payload_reserve(rt_entry, hdr->payload_len);
+	if(hdr->payload_len > 0) {
+		memcpy(rt_entry->payload, payload, hdr->payload_len);
+	}
+	rt_entry->frags_collected_total_len = hdr->payload_len;
+	if(hdr->frags_collected_cnt > 0) {
+		rt_entry->fragments = LA_HEAP_XCALLOC(hdr->frags_collected_cnt, sizeof(la_reasm_fragment));
+		rt_entry->fragments_size = hdr->frags_collected_cnt;
+		for(int i = 0; i < hdr->frags_collected_cnt; i++) {
+			la_reasm_snapshot_fragment frag;
+			memcpy(&frag, frags + i * sizeof(frag), sizeof(frag));
+			rt_entry->fragments[i] = (la_reasm_fragment){
+				.seq_num = frag.seq_num,
+				.offset = frag.offset,
+				.len = frag.len
+			};
+			if(rt_entry->out_of_order) {
+				rt_entry->frags_collected_cnt = i + 1;
+				la_reasm_seq_num_track(rt_entry, frag.seq_num);
+			}
+		}
+		rt_entry->frags_collected_cnt = hdr->frags_collected_cnt;
+	}
+	la_reasm_expiry_heap_push(shard, rt_entry);
+	la_reasm_usage_add(rt_entry);
+	la_reasm_usage_update(rt_entry);
+	la_hash_insert_with_hash(shard->fragment_table, rt_entry->key, rt_entry, key_hash);
+
+	// Apply the same limits as for entries created by la_reasm_fragment_add().
+	// The snapshot might have been taken with less strict limits in place.
+	la_reasm_limits const *limits = la_reasm_fragments_limit_check(rt_entry, 0);
+	if(limits != NULL) {
+		la_reasm_entry_evict(rt_entry, limits, LA_REASM_EVICT_MAX_FRAGMENTS);
+		goto end;
+	}
+	limits = la_reasm_bytes_limit_enforce(rt_entry);
+	if(limits != NULL) {
+		la_reasm_entry_evict(rt_entry, limits, LA_REASM_EVICT_MAX_BYTES);
+	}
+end:
+	la_reasm_ctx_shard_unlock(shard->ctx_shard);
+}
+
+// Walks through entries of a table section and validates them. If rtable
+// is not NULL, the entries are also restored into this table.
+static bool la_reasm_snapshot_section_load(la_reasm_table *rtable, uint8_t const *data,
+		size_t len, uint32_t entry_cnt) {
+	la_reasm_snapshot_reader r = { .buf = data, .len = len, .pos = 0 };
+	for(uint32_t i = 0; i < entry_cnt; i++) {
+		la_reasm_snapshot_entry_hdr hdr;
+		if(!LA_REASM_SNAPSHOT_READ_RECORD(&r, hdr)) {
+			return false;
+		}
+		if(!la_reasm_snapshot_entry_hdr_valid(&hdr)) {
+			return false;
+		}
+		// Check the lengths against the remaining data before computing
+		// the size of the fragment index, which might overflow size_t
+		// on 32-bit platforms otherwise.
+		size_t remaining = r.len - r.pos;
+		if(hdr.key_len > remaining || (size_t)hdr.payload_len > remaining ||
+				(size_t)hdr.frags_collected_cnt > remaining / sizeof(la_reasm_snapshot_fragment)) {
+			return false;
+		}
+		uint8_t const *key_data = la_reasm_snapshot_read(&r, hdr.key_len);
+		uint8_t const *frags = la_reasm_snapshot_read(&r,
+				(size_t)hdr.frags_collected_cnt * sizeof(la_reasm_snapshot_fragment));
+		uint8_t const *payload = la_reasm_snapshot_read(&r, hdr.payload_len);
+		if(key_data == NULL || frags == NULL || payload == NULL) {
+			return false;
+		}
+		if(!la_reasm_snapshot_fragments_valid(frags, hdr.frags_collected_cnt, hdr.payload_len,
+					(hdr.flags & LA_REASM_SNAPSHOT_ENTRY_OUT_OF_ORDER) != 0)) {
+			return false;
+		}
+		if(rtable != NULL) {
+			la_reasm_snapshot_entry_restore(rtable, &hdr, key_data, frags, payload);
+		}
+	}
+	return r.pos == r.len;
+}
+
+typedef struct {
+	char const *name;                   /* not NULL-terminated */
+	uint32_t name_len;
+	uint32_t entry_cnt;
+	uint8_t const *entries;
+	size_t entries_len;
+} la_reasm_snapshot_table;
+
+// Reads the header of the next table section and skips the section.
+static bool la_reasm_snapshot_table_read(la_reasm_snapshot_reader *r, la_reasm_snapshot_table *result) {
+	la_reasm_snapshot_table_hdr thdr;
+	if(!LA_REASM_SNAPSHOT_READ_RECORD(r, thdr) || thdr.len > r->len - r->pos) {
+		return false;
+	}
+	uint8_t const *section = la_reasm_snapshot_read(r, (size_t)thdr.len);
+	size_t entries_offset = LA_REASM_SNAPSHOT_ALIGN((size_t)thdr.name_len);
+	if(section == NULL || entries_offset > thdr.len) {
+		return false;
+	}
+	*result = (la_reasm_snapshot_table){
+		.name = (char const *)section,
+		.name_len = thdr.name_len,
+		.entry_cnt = thdr.entry_cnt,
+		.entries = section + entries_offset,
+		.entries_len = (size_t)thdr.len - entries_offset
+	};
+	return true;
+}
+
+static la_reasm_table *la_reasm_table_find_by_codec_name(la_reasm_ctx *rctx, char const *name) {
+	for(size_t i = 0; i < rctx->rtables->len; i++) {
+		la_reasm_table *rt = rctx->rtables->items[i];
+		if(rt->codec.name != NULL && strcmp(rt->codec.name, name) == 0) {
+			return rt;
+		}
+	}
+	return NULL;
+}
+
+// Restores the reassembly state from a snapshot created with
+// la_reasm_ctx_snapshot(). Table sections are loaded into existing tables
+// with matching key codec names. Other sections are copied and loaded
+// when a key codec with a matching name is set on a table (which typically
+// happens when the decoder creates its table on first use).
+// The buffer is not modified and may be released when the function returns.
+// Returns false if the snapshot is invalid (nothing is restored then).
+bool la_reasm_ctx_restore(la_reasm_ctx *rctx, uint8_t const *buf, size_t len) {
+	la_assert(rctx != NULL);
+	la_assert(buf != NULL);
+
+	la_reasm_snapshot_reader r = { .buf = buf, .len = len, .pos = 0 };
+	la_reasm_snapshot_hdr hdr;
+	if(!LA_REASM_SNAPSHOT_READ_RECORD(&r, hdr)) {
+		return false;
+	}
+	if(memcmp(hdr.magic, LA_REASM_SNAPSHOT_MAGIC, sizeof(hdr.magic)) != 0 ||
+			hdr.bom != LA_REASM_SNAPSHOT_BOM || hdr.version != LA_REASM_SNAPSHOT_VERSION) {
+		la_debug_print(D_ERROR, "unsupported snapshot format\n");
+		return false;
+	}
+
+	// Validate everything first, so that a corrupted snapshot
+	// does not get restored partially.
+	size_t tables_pos = r.pos;
+	la_reasm_snapshot_table table;
+	for(uint32_t t = 0; t < hdr.table_cnt; t++) {
+		if(!la_reasm_snapshot_table_read(&r, &table) ||
+				!la_reasm_snapshot_section_load(NULL, table.entries, table.entries_len, table.entry_cnt)) {
+			la_debug_print(D_ERROR, "snapshot table %u is corrupted\n", t);
+			return false;
+		}
+	}
+
+	r.pos = tables_pos;
+	la_reasm_rtables_wrlock(rctx);
+	for(uint32_t t = 0; t < hdr.table_cnt; t++) {
+		la_reasm_snapshot_table_read(&r, &table);
+		char *name = LA_HEAP_XCALLOC(table.name_len + 1, sizeof(char));
+		memcpy(name, table.name, table.name_len);
+		la_reasm_table *rtable = la_reasm_table_find_by_codec_name(rctx, name);
+		if(rtable != NULL) {
+			la_debug_print(D_INFO, "%s: restoring %u entries\n", name, table.entry_cnt);
+			la_reasm_snapshot_section_load(rtable, table.entries, table.entries_len, table.entry_cnt);
+			LA_XFREE(name);
+		} else {
+			la_debug_print(D_INFO, "%s: table does not exist, deferring restore of %u entries\n",
+					name, table.entry_cnt);
+			LA_HEAP_NEW(la_reasm_snapshot_section, pending);
+			pending->name = name;
+			pending->data = LA_HEAP_XCALLOC(LA_MAX(table.entries_len, 1), sizeof(uint8_t));
+			memcpy(pending->data, table.entries, table.entries_len);
+			pending->len = table.entries_len;
+			pending->entry_cnt = table.entry_cnt;
+			la_vec_append(rctx->pending_sections, pending);
+		}
+	}
+	la_reasm_rtables_unlock(rctx);
+	return true;
+}
+
+// Restores the pending snapshot section into the table ctx, if the codec names
+// match. Returns true if the section has been restored (and freed).
+static bool la_reasm_pending_section_restore(void *item, void *ctx) {
+	la_reasm_snapshot_section *section = item;
+	la_reasm_table *rtable = ctx;
+	if(strcmp(section->name, rtable->codec.name) != 0) {
+		return false;
+	}
+	la_debug_print(D_INFO, "%s: restoring %u pending entries\n", section->name, section->entry_cnt);
+	la_reasm_snapshot_section_load(rtable, section->data, section->len, section->entry_cnt);
+	la_reasm_snapshot_section_destroy(section);
+	return true;
+}
+
+// Sets the key codec of the table, which enables saving its entries in
+// snapshots. Any pending snapshot sections of a table with the same codec
+// name are restored into this table.
+void la_reasm_table_key_codec_set(la_reasm_table *rtable, la_reasm_key_codec const *codec) {
+	la_assert(rtable != NULL);
+	la_assert(codec != NULL);
+	la_assert(codec->name != NULL);
+	la_assert(codec->serialize_key != NULL);
+	la_assert(codec->deserialize_key != NULL);
+
+	la_reasm_ctx *rctx = rtable->rctx;
+	la_reasm_rtables_wrlock(rctx);
+	rtable->codec = *codec;
+	(void)la_vec_remove_if(rctx->pending_sections, la_reasm_pending_section_restore, rtable);
+	la_reasm_rtables_unlock(rctx);
+}
+
 char const *la_reasm_status_name_get(la_reasm_status status) {
 	static char const *reasm_status_names[] = {
 		[LA_REASM_UNKNOWN] = "unknown",
@@ -488,7 +2447,8 @@ char const *la_reasm_status_name_get(la_reasm_status status) {
 		[LA_REASM_SKIPPED] = "skipped",
 		[LA_REASM_DUPLICATE] = "duplicate",
 		[LA_REASM_FRAG_OUT_OF_SEQUENCE] = "out of sequence",
-		[LA_REASM_ARGS_INVALID] = "invalid args"
+		[LA_REASM_ARGS_INVALID] = "invalid args",
+		[LA_REASM_LIMIT_EXCEEDED] = "limit exceeded"
 	};
 	if(status < 0 || status > LA_REASM_STATUS_MAX) {
 		return NULL;
@@ -10,6 +10,8 @@
 extern "C" {
 #endif
 #include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #ifndef _MSC_VER
 #include <sys/time.h>
 #else
@@ -68,12 +70,40 @@ typedef struct {
 	                                   is completed when the number of collected fragments
 	                                   reaches this value. */
 	uint32_t flags;                 /* One or more flags (listed below) */
-// reserved for future use
-	void (*reserved2)(void);
-	void (*reserved3)(void);
+
+	void const *tmp_key;            /* Optional lookup key built by the caller (eg. on the
+	                                   stack). If set, it is used instead of the key
+	                                   returned by get_tmp_key(). It is not stored in the
+	                                   table nor freed. */
+
+	// key_hash and timeout_class share storage, so that the size of the
+	// structure does not change on any platform. Hence LA_REASM_KEY_HASH_SET
+	// and LA_REASM_ADAPTIVE_TIMEOUT flags must not be used together.
+	union {
+		uint32_t key_hash;          /* Optional hash value of the key, as returned by
+		                               hash_key(). Used only when LA_REASM_KEY_HASH_SET
+		                               flag is set. */
+
+		uint32_t timeout_class;     /* Identifier of a class of messages with similar
+		                               timing (eg. bearer, direction and label). Used
+		                               only when LA_REASM_ADAPTIVE_TIMEOUT flag is set. */
+	};
 } la_reasm_fragment_info;
 
 #define LA_ALLOW_OUT_OF_ORDER_DELIVERY (1 << 0)     /* Allows out of order delivery of fragments */
+#define LA_REASM_KEY_HASH_SET (1 << 1)              /* key_hash field contains a valid value */
+#define LA_REASM_ADAPTIVE_TIMEOUT (1 << 2)          /* Expire the message early if no fragment
+                                                       arrives within a timeout learned from
+                                                       the timeout_class (reasm_timeout still
+                                                       applies as the upper bound) */
+#define LA_REASM_RESTART_IF_CHANGED (1 << 3)        /* If the message is being reassembled
+                                                       already, but with a different length,
+                                                       discard it and start a new one.
+                                                       total_pdu_len is compared if it is
+                                                       known for the message, otherwise
+                                                       total_fragment_cnt is. Fragments with
+                                                       the compared field set to 0 never
+                                                       restart the message. */
 
 typedef enum {
 	LA_REASM_UNKNOWN,
@@ -82,18 +112,201 @@ typedef enum {
 	LA_REASM_SKIPPED,
 	LA_REASM_DUPLICATE,
 	LA_REASM_FRAG_OUT_OF_SEQUENCE,
-	LA_REASM_ARGS_INVALID
+	LA_REASM_ARGS_INVALID,
+	LA_REASM_LIMIT_EXCEEDED
 } la_reasm_status;
-#define LA_REASM_STATUS_MAX LA_REASM_ARGS_INVALID
+#define LA_REASM_STATUS_MAX LA_REASM_LIMIT_EXCEEDED
+
+typedef enum {
+	LA_REASM_EVICT_MAX_BYTES,
+	LA_REASM_EVICT_MAX_ENTRIES,
+	LA_REASM_EVICT_MAX_FRAGMENTS
+} la_reasm_evict_reason;
+
+typedef struct {
+	void const *table_id;           /* table_id of the table owning the evicted entry */
+
+	void const *key;                /* hash key of the evicted entry (as returned
+	                                   by get_key callback); valid only during
+	                                   the callback */
+
+	la_reasm_evict_reason reason;   /* which limit has been hit */
+
+	int frags_collected_cnt;        /* number of fragments collected so far */
+
+	int frags_collected_total_len;  /* total length of fragments collected so far */
+
+	struct timeval first_frag_rx_time;  /* time of arrival of the first fragment */
+// reserved for future use
+	void (*reserved0)(void);
+	void (*reserved1)(void);
+	void (*reserved2)(void);
+	void (*reserved3)(void);
+} la_reasm_eviction_info;
+
+typedef void (la_reasm_evict_func)(la_reasm_eviction_info const *info, void *ctx);
+
+typedef struct {
+	size_t max_bytes;               /* max amount of memory held by reassembly
+	                                   table entries (0 = no limit) */
+
+	size_t max_entries;             /* max number of messages being reassembled
+	                                   simultaneously (0 = no limit) */
+
+	int max_fragments_per_entry;    /* max number of fragments of a single
+	                                   message (0 = no limit) */
+
+	la_reasm_evict_func *evict_cb;  /* optional callback called for each entry
+	                                   evicted due to these limits */
+
+	void *evict_cb_ctx;             /* context pointer passed to evict_cb */
+// reserved for future use
+	void (*reserved0)(void);
+	void (*reserved1)(void);
+	void (*reserved2)(void);
+	void (*reserved3)(void);
+} la_reasm_limits;
+
+typedef struct {
+	int seq_num;                    /* sequence number of this fragment */
+
+	uint8_t const *data;            /* fragment payload */
+
+	int len;                        /* fragment payload length */
+
+	bool gap_before;                /* true if one or more fragments are missing
+	                                   between the previous fragment and this one */
+// reserved for future use
+	void (*reserved0)(void);
+	void (*reserved1)(void);
+} la_reasm_partial_fragment;
+
+typedef struct {
+	void const *table_id;           /* table_id of the table owning the expired entry */
+
+	void const *key;                /* hash key of the expired entry (as returned
+	                                   by get_key callback) */
+
+	struct timeval first_frag_rx_time;  /* time of arrival of the first fragment */
+
+	int total_pdu_len;              /* expected total message length (0 if unknown) */
+
+	int total_fragment_cnt;         /* expected number of fragments (0 if unknown) */
+
+	int frags_collected_cnt;        /* number of fragments collected */
+
+	int frags_collected_total_len;  /* total length of fragments collected */
+
+	int gap_cnt;                    /* number of gaps between collected fragments */
+
+	uint8_t const *payload;         /* payloads of all collected fragments
+	                                   concatenated in fragment order */
+
+	la_reasm_partial_fragment const *fragments;
+	                                /* collected fragments in fragment order
+	                                   (frags_collected_cnt elements) */
+// reserved for future use
+	void (*reserved0)(void);
+	void (*reserved1)(void);
+	void (*reserved2)(void);
+	void (*reserved3)(void);
+} la_reasm_expiry_info;
+
+typedef void (la_reasm_expire_func)(la_reasm_expiry_info const *info, void *ctx);
+
+// Number of buckets in time-to-complete histogram. Bucket upper bounds are:
+// 1, 2, 5, 10, 30, 60, 120, 300, 600, 1200 seconds and infinity.
+#define LA_REASM_TTC_BUCKET_CNT 11
+
+// Number of buckets in the histogram of fragment counts of completed messages.
+// Buckets hold counts of: 1, 2, 3, 4, 5-8, 9-16, 17-32, 33+ fragments.
+#define LA_REASM_FRAGS_BUCKET_CNT 8
+
+typedef struct {
+	uint64_t status_cnt[LA_REASM_STATUS_MAX + 1];   /* number of la_reasm_fragment_add()
+	                                                   results, indexed by la_reasm_status */
+
+	uint64_t expired_cnt;           /* entries removed due to reassembly timeout */
+
+	uint64_t evicted_cnt;           /* entries removed due to limits */
+
+	uint64_t discarded_cnt;         /* entries removed with la_reasm_payload_discard() */
+
+	size_t entries;                 /* number of entries currently in the table */
+
+	size_t peak_entries;            /* maximum number of entries in the table */
+
+	size_t bytes;                   /* memory currently held by the table entries */
+
+	size_t peak_bytes;              /* maximum memory held by the table entries */
+
+	uint64_t completed_frags_total; /* total number of fragments of completed messages */
+
+	uint64_t frags_hist[LA_REASM_FRAGS_BUCKET_CNT];
+	                                /* histogram of fragment counts of completed messages */
+
+	uint64_t ttc_hist[LA_REASM_TTC_BUCKET_CNT];
+	                                /* histogram of time to complete (the time between
+	                                   the arrival of the first and the last fragment) */
+// reserved for future use
+	void (*reserved0)(void);
+	void (*reserved1)(void);
+	void (*reserved2)(void);
+	void (*reserved3)(void);
+} la_reasm_table_stats;
+
+// Serializes the key into buf (at most buflen bytes). Returns the length
+// of the serialized key. If it is larger than buflen, the function is
+// called again with a larger buffer.
+typedef size_t (la_reasm_key_serialize_func)(void const *key, uint8_t *buf, size_t buflen);
+
+// Builds a key (as get_key() does) from its serialized form.
+// Returns NULL if the data is invalid.
+typedef void *(la_reasm_key_deserialize_func)(uint8_t const *buf, size_t len);
+
+typedef struct {
+	char const *name;               /* name identifying the table in snapshots
+	                                   (must not change between program runs) */
+
+	la_reasm_key_serialize_func *serialize_key;
+
+	la_reasm_key_deserialize_func *deserialize_key;
+// reserved for future use
+	void (*reserved0)(void);
+	void (*reserved1)(void);
+	void (*reserved2)(void);
+	void (*reserved3)(void);
+} la_reasm_key_codec;
 
 // reassembly.c
 la_reasm_ctx *la_reasm_ctx_new();
+la_reasm_ctx *la_reasm_ctx_new_with_limits(la_reasm_limits const *limits);
+la_reasm_ctx *la_reasm_ctx_new_concurrent(int shard_cnt, la_reasm_limits const *limits);
 void la_reasm_ctx_destroy(void *ctx);
 la_reasm_table *la_reasm_table_new(la_reasm_ctx *rctx, void const *table_id,
 		la_reasm_table_funcs funcs, int cleanup_interval);
+la_reasm_table *la_reasm_table_new_with_limits(la_reasm_ctx *rctx, void const *table_id,
+		la_reasm_table_funcs funcs, la_reasm_limits const *limits);
+void la_reasm_table_limits_set(la_reasm_table *rtable, la_reasm_limits const *limits);
+bool la_reasm_ctx_stats_get(la_reasm_ctx *rctx, void const *table_id, la_reasm_table_stats *result);
+void la_reasm_table_stats_get(la_reasm_table const *rtable, la_reasm_table_stats *result);
+void la_reasm_table_stats_reset(la_reasm_table *rtable);
+size_t la_reasm_ctx_expire(la_reasm_ctx *rctx, struct timeval now);
+void la_reasm_ctx_expiry_cb_set(la_reasm_ctx *rctx, void const *table_id,
+		la_reasm_expire_func *cb, void *cb_ctx);
+void la_reasm_table_key_codec_set(la_reasm_table *rtable, la_reasm_key_codec const *codec);
+size_t la_reasm_ctx_snapshot(la_reasm_ctx *rctx, uint8_t **result);
+bool la_reasm_ctx_restore(la_reasm_ctx *rctx, uint8_t const *buf, size_t len);
 la_reasm_table *la_reasm_table_lookup(la_reasm_ctx *rctx, void const *table_id);
 la_reasm_status la_reasm_fragment_add(la_reasm_table *rtable, la_reasm_fragment_info const *finfo);
+la_reasm_status la_reasm_fragment_add_and_reassemble(la_reasm_table *rtable,
+		la_reasm_fragment_info const *finfo, uint8_t **result, int *result_len);
 int la_reasm_payload_get(la_reasm_table *rtable, void const *msg_info, uint8_t **result);
+int la_reasm_payload_get_with_key(la_reasm_table *rtable, void const *tmp_key,
+		uint32_t key_hash, uint8_t **result);
+bool la_reasm_payload_discard(la_reasm_table *rtable, void const *msg_info);
+bool la_reasm_payload_discard_with_key(la_reasm_table *rtable, void const *tmp_key,
+		uint32_t key_hash);
 char const *la_reasm_status_name_get(la_reasm_status status);
 
 #ifdef __cplusplus
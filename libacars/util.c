@@ -5,16 +5,12 @@
  */
 #include <stdio.h>              // fprintf
 #include <stdint.h>
-#include <stdlib.h>             // calloc, realloc, free
-#include <string.h>             // strerror, strlen, strdup, strnlen, strspn, strpbrk
+#include <stdlib.h>             // calloc, realloc, free, abort
+#include <string.h>             // strlen, strnlen, strspn, strpbrk
 #include <time.h>               // struct tm
 #include <limits.h>             // CHAR_BIT
-#include <errno.h>              // errno
-#include "config.h"             // HAVE_STRSEP, WITH_LIBXML2, WITH_JANSSON, HAVE_UNISTD_H
-#include "libacars.h"           // la_config_get_bool
-#ifdef HAVE_UNISTD_H
-#include <unistd.h>             // _exit
-#endif
+#include "config.h"             // HAVE_STRSEP, WITH_LIBXML2, WITH_JANSSON, WITH_ALLOC_STATS
+#include "libacars.h"           // la_decoder_config_get, la_allocator, la_alloc_stats
 #ifdef WITH_LIBXML2
 #include <libxml/parser.h>      // xmlParseDoc
 #include <libxml/tree.h>        // xmlBuffer.*, xmlNodeDump, xmlDocGetRootElement, xmlFreeDoc
@@ -26,27 +22,254 @@
 #ifdef WITH_JANSSON
 #include <jansson.h>
 #endif
-#include <libacars/macros.h>    // la_debug_print()
+#include <libacars/macros.h>    // la_debug_print(), LA_THREAD_LOCAL
+#include <libacars/hash.h>      // la_hash_bytes(), LA_HASH_INIT
+#include <libacars/arena.h>     // la_arena_get()
 #include <libacars/util.h>
 
+/********************************************************************************
+ * Memory allocation
+ ********************************************************************************/
+
+static void *la_libc_calloc(size_t nmemb, size_t size, void *ctx) {
+	LA_UNUSED(ctx);
+	return calloc(nmemb, size);
+}
+
+static void *la_libc_realloc(void *ptr, size_t size, void *ctx) {
+	LA_UNUSED(ctx);
+	return realloc(ptr, size);
+}
+
+static void la_libc_free(void *ptr, void *ctx) {
+	LA_UNUSED(ctx);
+	free(ptr);
+}
+
+static la_allocator const la_default_allocator = {
+	.calloc_cb = la_libc_calloc,
+	.realloc_cb = la_libc_realloc,
+	.free_cb = la_libc_free,
+	.strdup_cb = NULL,
+	.failure_cb = NULL,
+	.ctx = NULL
+};
+
+static la_allocator la_alloc = la_default_allocator;
+
+// Sets the functions used for all heap allocations made by libacars
+// (including the ASN.1 runtime and memory chunks of arenas).
+// NULL restores the default allocator (libc). This shall be done before
+// any other libacars function is called, or when all memory allocated
+// with the previous allocator has been freed.
+void la_set_allocator(la_allocator const *allocator) {
+	if(allocator == NULL) {
+		la_alloc = la_default_allocator;
+		return;
+	}
+	la_assert(allocator->calloc_cb != NULL);
+	la_assert(allocator->realloc_cb != NULL);
+	la_assert(allocator->free_cb != NULL);
+	la_alloc = *allocator;
+}
+
+// Called when an allocation has failed. Returns true if the allocation
+// shall be retried, otherwise aborts the program.
+static bool la_alloc_failed(size_t size, char const *file, int line, char const *func) {
+	if(la_alloc.failure_cb != NULL && la_alloc.failure_cb(size, la_alloc.ctx) == true) {
+		return true;
+	}
+	fprintf(stderr, "%s:%d: %s(): failed to allocate %zu bytes\n", file, line, func, size);
+	abort();
+}
+
+// Called when an allocation has failed in a way which retrying can't fix
+// (the requested size overflows). The failure callback is notified once,
+// then the program is aborted.
+static void la_alloc_failed_permanently(size_t size, char const *file, int line, char const *func) {
+	if(la_alloc.failure_cb != NULL) {
+		(void)la_alloc.failure_cb(size, la_alloc.ctx);
+	}
+	fprintf(stderr, "%s:%d: %s(): allocation size overflow (%zu bytes)\n", file, line, func, size);
+	abort();
+}
+
+static size_t la_alloc_size(size_t nmemb, size_t size) {
+	return size != 0 && nmemb > SIZE_MAX / size ? SIZE_MAX : nmemb * size;
+}
+
+#ifdef WITH_ALLOC_STATS
+static LA_THREAD_LOCAL la_alloc_module la_alloc_current_module = LA_ALLOC_MODULE_OTHER;
+static LA_THREAD_LOCAL la_alloc_stats la_alloc_stats_table[LA_ALLOC_MODULE_MAX + 1];
+#define LA_ALLOC_STATS_ADD(field, n) la_alloc_stats_table[la_alloc_current_module].field += (n)
+
+// Sets the module to which allocations made by the calling thread are
+// attributed. Returns the previous one, which shall be restored with
+// la_alloc_module_leave().
+int la_alloc_module_enter(int module) {
+	la_assert(module >= 0);
+	la_assert(module <= LA_ALLOC_MODULE_MAX);
+	int prev = la_alloc_current_module;
+	la_alloc_current_module = module;
+	return prev;
+}
+
+void la_alloc_module_leave(int prev) {
+	la_alloc_current_module = prev;
+}
+#else
+#define LA_ALLOC_STATS_ADD(field, n) la_nop()
+#endif
+
+static void *la_heap_calloc(size_t nmemb, size_t size, char const *file, int line, char const *func) {
+	if(size != 0 && nmemb > SIZE_MAX / size) {
+		la_alloc_failed_permanently(SIZE_MAX, file, line, func);
+	}
+	void *ptr = NULL;
+	while((ptr = la_alloc.calloc_cb(nmemb, size, la_alloc.ctx)) == NULL) {
+		la_alloc_failed(la_alloc_size(nmemb, size), file, line, func);
+	}
+	return ptr;
+}
+
+static void *la_heap_realloc(void *ptr, size_t size, char const *file, int line, char const *func) {
+	void *result = NULL;
+	while((result = la_alloc.realloc_cb(ptr, size, la_alloc.ctx)) == NULL) {
+		la_alloc_failed(size, file, line, func);
+	}
+	return result;
+}
+
+void *la_heap_xcalloc(size_t nmemb, size_t size, char const *file, int line, char const *func) {
+	LA_ALLOC_STATS_ADD(allocs, 1);
+	LA_ALLOC_STATS_ADD(heap_allocs, 1);
+	LA_ALLOC_STATS_ADD(bytes, la_alloc_size(nmemb, size));
+	return la_heap_calloc(nmemb, size, file, line, func);
+}
+
+void *la_heap_xrealloc(void *ptr, size_t size, char const *file, int line, char const *func) {
+	LA_ALLOC_STATS_ADD(reallocs, 1);
+	LA_ALLOC_STATS_ADD(heap_allocs, 1);
+	LA_ALLOC_STATS_ADD(bytes, size);
+	return la_heap_realloc(ptr, size, file, line, func);
+}
+
+char *la_heap_xstrdup(char const *s, char const *file, int line, char const *func) {
+	la_assert(s != NULL);
+	size_t len = strlen(s);
+	LA_ALLOC_STATS_ADD(allocs, 1);
+	LA_ALLOC_STATS_ADD(heap_allocs, 1);
+	LA_ALLOC_STATS_ADD(bytes, len + 1);
+	char *result = NULL;
+	if(la_alloc.strdup_cb != NULL) {
+		while((result = la_alloc.strdup_cb(s, la_alloc.ctx)) == NULL) {
+			la_alloc_failed(len + 1, file, line, func);
+		}
+		return result;
+	}
+	result = la_heap_calloc(len + 1, sizeof(char), file, line, func);
+	memcpy(result, s, len);
+	return result;
+}
+
+void la_heap_xfree(void *ptr) {
+	if(ptr != NULL) {
+		LA_ALLOC_STATS_ADD(frees, 1);
+		la_alloc.free_cb(ptr, la_alloc.ctx);
+	}
+}
+
 void *la_xcalloc(size_t nmemb, size_t size, char const *file, int line, char const *func) {
-	void *ptr = calloc(nmemb, size);
+	la_arena *arena = la_arena_get();
+	if(arena == NULL) {
+		return la_heap_xcalloc(nmemb, size, file, line, func);
+	}
+	LA_ALLOC_STATS_ADD(allocs, 1);
+	LA_ALLOC_STATS_ADD(bytes, la_alloc_size(nmemb, size));
+	// Arena allocations fail only if the size overflows
+	void *ptr = la_arena_alloc(arena, nmemb, size);
 	if(ptr == NULL) {
-		fprintf(stderr, "%s:%d: %s(): calloc(%zu, %zu) failed: %s\n",
-				file, line, func, nmemb, size, strerror(errno));
-		_exit(1);
+		la_alloc_failed_permanently(la_alloc_size(nmemb, size), file, line, func);
 	}
 	return ptr;
 }
 
 void *la_xrealloc(void *ptr, size_t size, char const *file, int line, char const *func) {
-	ptr = realloc(ptr, size);
+	la_arena *arena = la_arena_get();
+	void *result = NULL;
+	if(arena == NULL || la_arena_realloc(arena, ptr, size, &result) == false) {
+		return la_heap_xrealloc(ptr, size, file, line, func);
+	}
+	LA_ALLOC_STATS_ADD(reallocs, 1);
+	LA_ALLOC_STATS_ADD(bytes, size);
+	// Arena allocations fail only if the size overflows
+	if(result == NULL) {
+		la_alloc_failed_permanently(size, file, line, func);
+	}
+	return result;
+}
+
+char *la_xstrdup(char const *s, char const *file, int line, char const *func) {
+	la_assert(s != NULL);
+	if(la_arena_get() == NULL) {
+		return la_heap_xstrdup(s, file, line, func);
+	}
+	size_t len = strlen(s);
+	char *result = la_xcalloc(len + 1, sizeof(char), file, line, func);
+	memcpy(result, s, len);
+	return result;
+}
+
+void la_xfree(void *ptr) {
 	if(ptr == NULL) {
-		fprintf(stderr, "%s:%d: %s(): realloc(%zu) failed: %s\n",
-				file, line, func, size, strerror(errno));
-		_exit(1);
+		return;
 	}
-	return ptr;
+	la_arena *arena = la_arena_get();
+	if(arena != NULL && la_arena_free(arena, ptr) == true) {
+		LA_ALLOC_STATS_ADD(frees, 1);
+		return;
+	}
+	la_heap_xfree(ptr);
+}
+
+bool la_alloc_stats_get(la_alloc_module module, la_alloc_stats *result) {
+	la_assert(module >= 0);
+	la_assert(module <= LA_ALLOC_MODULE_MAX);
+	la_assert(result != NULL);
+#ifdef WITH_ALLOC_STATS
+	*result = la_alloc_stats_table[module];
+	return true;
+#else
+	LA_UNUSED(module);
+	memset(result, 0, sizeof(la_alloc_stats));
+	return false;
+#endif
+}
+
+void la_alloc_stats_reset() {
+#ifdef WITH_ALLOC_STATS
+	memset(la_alloc_stats_table, 0, sizeof(la_alloc_stats_table));
+#endif
+}
+
+char const *la_alloc_module_name_get(la_alloc_module module) {
+	static char const *module_names[LA_ALLOC_MODULE_MAX + 1] = {
+		[LA_ALLOC_MODULE_OTHER] = "other",
+		[LA_ALLOC_MODULE_ACARS] = "acars",
+		[LA_ALLOC_MODULE_ARINC] = "arinc",
+		[LA_ALLOC_MODULE_CPDLC] = "cpdlc",
+		[LA_ALLOC_MODULE_ADSC] = "adsc",
+		[LA_ALLOC_MODULE_MIAM] = "miam",
+		[LA_ALLOC_MODULE_MIAM_CORE] = "miam-core",
+		[LA_ALLOC_MODULE_OHMA] = "ohma",
+		[LA_ALLOC_MODULE_MEDIA_ADV] = "media-adv",
+		[LA_ALLOC_MODULE_REASSEMBLY] = "reassembly",
+		[LA_ALLOC_MODULE_FORMATTERS] = "formatters"
+	};
+	if(module < 0 || module > LA_ALLOC_MODULE_MAX) {
+		return NULL;
+	}
+	return module_names[module];
 }
 
 size_t la_slurp_hexstring(char* string, uint8_t **buf) {
@@ -80,8 +303,8 @@ size_t la_slurp_hexstring(char* string, uint8_t **buf) {
 
 char *la_hexdump(uint8_t *data, size_t len) {
 	static char const hex[] = "0123456789abcdef";
-	if(data == NULL) return strdup("<undef>");
-	if(len == 0) return strdup("<none>");
+	if(data == NULL) return LA_XSTRDUP("<undef>");
+	if(len == 0) return LA_XSTRDUP("<none>");
 
 	size_t rows = len / 16;
 	if((len & 0xf) != 0) {
@@ -307,6 +530,25 @@ uint32_t la_reverse(uint32_t v, int numbits) {
 	return r;
 }
 
+// Hashes a fixed-width key made of cnt 64-bit words.
+// Used for packed reassembly keys.
+uint32_t la_hash_words(uint64_t const *words, size_t cnt) {
+	la_assert(words != NULL);
+	return la_hash_bytes(words, cnt * sizeof(uint64_t), LA_HASH_INIT);
+}
+
+// Copies at most len characters of the string src into dst and fills the
+// rest of dst with zeros. The result is not NULL-terminated if src is len
+// characters long (or longer). Used for building fixed-width keys, which
+// must have equal contents for equal strings.
+void la_strpad(char *dst, char const *src, size_t len) {
+	la_assert(dst != NULL);
+	la_assert(src != NULL);
+	size_t slen = strnlen(src, len);
+	memcpy(dst, src, slen);
+	memset(dst + slen, 0, len - slen);
+}
+
 // BASE64 decoder
 
 static int32_t la_get_base64_idx(char c) {
@@ -438,9 +680,7 @@ end:
 char *la_json_pretty_print(char const *json_string) {
 	la_assert(json_string);
 
-	bool prettify_json = false;
-	(void)la_config_get_bool("prettify_json", &prettify_json);
-	if(prettify_json == false) {
+	if(la_decoder_config_get()->prettify_json == false) {
 		return NULL;
 	}
 
@@ -449,8 +689,13 @@ char *la_json_pretty_print(char const *json_string) {
 	json_error_t err;
 	json_t *root = json_loads(json_string, 0, &err);
 	if(root) {
-		result = json_dumps(root, JSON_INDENT(1) | JSON_REAL_PRECISION(6));
-		if(result == NULL) {
+		char *dumped = json_dumps(root, JSON_INDENT(1) | JSON_REAL_PRECISION(6));
+		if(dumped != NULL) {
+			// The buffer comes from jansson's allocator, while the caller
+			// frees the result with LA_XFREE, so it has to be copied.
+			result = LA_XSTRDUP(dumped);
+			free(dumped);
+		} else {
 			la_debug_print(D_INFO, "json_dumps() did not return any result\n");
 		}
 	} else {
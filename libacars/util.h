@@ -10,7 +10,8 @@
 #include <stddef.h>         // size_t
 #include <stdlib.h>         // free()
 #include <time.h>           // struct tm
-#include "config.h"         // HAVE_STRSEP, WITH_LIBXML2 WITH_ZLIB
+#include "config.h"         // HAVE_STRSEP, WITH_LIBXML2 WITH_ZLIB WITH_ALLOC_STATS
+#include <libacars/arena.h> // la_arena
 #ifdef WITH_LIBXML2
 #include <libxml/tree.h>    // xmlBufferPtr
 #endif
@@ -20,12 +21,50 @@ typedef struct {
 	size_t len;
 } la_octet_string;
 
+// LA_XCALLOC, LA_XREALLOC and LA_XSTRDUP allocate from the current arena of
+// the calling thread, if one is set (see arena.c). LA_HEAP_* variants always
+// allocate from the heap - these shall be used for long-lived objects, which
+// must outlive the decoded message (eg. reassembly state).
+// LA_XFREE handles both. Heap allocations are made with the allocator set
+// with la_set_allocator().
 void *la_xcalloc(size_t nmemb, size_t size, char const *file, int line, char const *func);
 void *la_xrealloc(void *ptr, size_t size, char const *file, int line, char const *func);
+char *la_xstrdup(char const *s, char const *file, int line, char const *func);
+void la_xfree(void *ptr);
+void *la_heap_xcalloc(size_t nmemb, size_t size, char const *file, int line, char const *func);
+void *la_heap_xrealloc(void *ptr, size_t size, char const *file, int line, char const *func);
+char *la_heap_xstrdup(char const *s, char const *file, int line, char const *func);
+void la_heap_xfree(void *ptr);
 
 #define LA_XCALLOC(nmemb, size) la_xcalloc((nmemb), (size), __FILE__, __LINE__, __func__)
 #define LA_XREALLOC(ptr, size) la_xrealloc((ptr), (size), __FILE__, __LINE__, __func__)
-#define LA_XFREE(ptr) do { free(ptr); ptr = NULL; } while(0)
+#define LA_XSTRDUP(s) la_xstrdup((s), __FILE__, __LINE__, __func__)
+#define LA_XFREE(ptr) do { la_xfree(ptr); ptr = NULL; } while(0)
+#define LA_HEAP_XCALLOC(nmemb, size) la_heap_xcalloc((nmemb), (size), __FILE__, __LINE__, __func__)
+#define LA_HEAP_XREALLOC(ptr, size) la_heap_xrealloc((ptr), (size), __FILE__, __LINE__, __func__)
+#define LA_HEAP_XSTRDUP(s) la_heap_xstrdup((s), __FILE__, __LINE__, __func__)
+#define LA_HEAP_XFREE(ptr) do { la_heap_xfree(ptr); ptr = NULL; } while(0)
+#define LA_HEAP_NEW(type, x) type *(x) = LA_HEAP_XCALLOC(1, sizeof(type))
+
+// Allocations made between LA_ALLOC_MODULE_ENTER and LA_ALLOC_MODULE_LEAVE
+// are attributed to the given module in allocation statistics. Scopes may
+// be nested, but they must be left in the same function.
+#ifdef WITH_ALLOC_STATS
+// module is a la_alloc_module value (libacars.h is not included here,
+// as some modules redeclare its functions as static).
+int la_alloc_module_enter(int module);
+void la_alloc_module_leave(int prev);
+#define LA_ALLOC_MODULE_ENTER(module) int la_alloc_prev_module = la_alloc_module_enter(module)
+#define LA_ALLOC_MODULE_LEAVE() la_alloc_module_leave(la_alloc_prev_module)
+#else
+#define LA_ALLOC_MODULE_ENTER(module) do {} while(0)
+#define LA_ALLOC_MODULE_LEAVE() do {} while(0)
+#endif
+
+// arena.c (internal)
+void *la_arena_alloc(la_arena *arena, size_t nmemb, size_t size);
+bool la_arena_realloc(la_arena *arena, void *ptr, size_t size, void **result);
+bool la_arena_free(la_arena *arena, void *ptr);
 
 #ifdef HAVE_STRSEP
 #include <string.h>
@@ -53,6 +92,8 @@ void la_octet_string_destroy(void *ostring_ptr);
 xmlBufferPtr la_prettify_xml(char const *buf);
 #endif
 uint32_t la_reverse(uint32_t v, int numbits);
+uint32_t la_hash_words(uint64_t const *words, size_t cnt);
+void la_strpad(char *dst, char const *src, size_t len);
 la_octet_string *la_base64_decode(char const *input, size_t input_len);
 
 #ifdef WITH_ZLIB
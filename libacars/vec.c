@@ -0,0 +1,90 @@
+/*
+ *  This file is a part of libacars
+ *
+ *  Copyright (c) 2018-2023 Tomasz Lemiech <szpajder@gmail.com>
+ */
+
+#include <stdbool.h>
+#include <libacars/macros.h>    // la_assert
+#include <libacars/vec.h>       // la_vec
+#include <libacars/util.h>      // LA_HEAP_XCALLOC, LA_HEAP_XREALLOC, LA_XFREE
+
+// Growable array of pointers. Items are stored contiguously, so appending
+// is amortized constant time and iterating does not chase pointers
+// scattered across the heap (as it's the case with la_list).
+
+#define LA_VEC_INITIAL_SIZE 8
+#define LA_VEC_SIZE_MULT 2
+
+la_vec *la_vec_new() {
+	LA_HEAP_NEW(la_vec, v);
+	return v;
+}
+
+void la_vec_append(la_vec *v, void *item) {
+	la_assert(v != NULL);
+	if(v->len == v->allocated_size) {
+		v->allocated_size = v->allocated_size > 0 ?
+			v->allocated_size * LA_VEC_SIZE_MULT : LA_VEC_INITIAL_SIZE;
+		v->items = LA_HEAP_XREALLOC(v->items, v->allocated_size * sizeof(void *));
+	}
+	v->items[v->len++] = item;
+}
+
+void *la_vec_get(la_vec const *v, size_t idx) {
+	la_assert(v != NULL);
+	la_assert(idx < v->len);
+	return v->items[idx];
+}
+
+size_t la_vec_length(la_vec const *v) {
+	return v != NULL ? v->len : 0;
+}
+
+void la_vec_foreach(la_vec *v, void (*cb)(), void *ctx) {
+	la_assert(cb != NULL);
+	if(v == NULL) {
+		return;
+	}
+	for(size_t i = 0; i < v->len; i++) {
+		cb(v->items[i], ctx);
+	}
+}
+
+// Removes all items for which if_func returns true, preserving the order
+// of the remaining items. Removed items are not freed - if_func may do it
+// before returning true. Returns the number of items removed.
+size_t la_vec_remove_if(la_vec *v, la_vec_if_func *if_func, void *ctx) {
+	la_assert(if_func != NULL);
+	if(v == NULL) {
+		return 0;
+	}
+	size_t kept = 0;
+	for(size_t i = 0; i < v->len; i++) {
+		if(if_func(v->items[i], ctx) == false) {
+			v->items[kept++] = v->items[i];
+		}
+	}
+	size_t removed = v->len - kept;
+	v->len = kept;
+	return removed;
+}
+
+void la_vec_free_full(la_vec *v, void (*item_free)()) {
+	if(v == NULL) {
+		return;
+	}
+	for(size_t i = 0; i < v->len; i++) {
+		if(item_free != NULL) {
+			item_free(v->items[i]);
+		} else {
+			LA_XFREE(v->items[i]);
+		}
+	}
+	LA_XFREE(v->items);
+	LA_XFREE(v);
+}
+
+void la_vec_free(la_vec *v) {
+	la_vec_free_full(v, NULL);
+}
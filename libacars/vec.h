@@ -0,0 +1,37 @@
+/*
+ *  This file is a part of libacars
+ *
+ *  Copyright (c) 2018-2023 Tomasz Lemiech <szpajder@gmail.com>
+ */
+#ifndef LA_VEC_H
+#define LA_VEC_H 1
+
+#include <stddef.h>     // size_t
+#include <stdbool.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct {
+	void **items;           // item pointer array
+	size_t len;             // current number of items
+	size_t allocated_size;  // current allocated size of the array (in items)
+} la_vec;
+
+typedef bool (la_vec_if_func)(void *item, void *ctx);
+
+la_vec *la_vec_new();
+void la_vec_append(la_vec *v, void *item);
+void *la_vec_get(la_vec const *v, size_t idx);
+size_t la_vec_length(la_vec const *v);
+void la_vec_foreach(la_vec *v, void (*cb)(), void *ctx);
+size_t la_vec_remove_if(la_vec *v, la_vec_if_func *if_func, void *ctx);
+void la_vec_free(la_vec *v);
+void la_vec_free_full(la_vec *v, void (*item_free)());
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // !LA_VEC_H
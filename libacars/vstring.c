@@ -9,9 +9,9 @@
 #include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
-#include <string.h>                 // memcpy, strdup, strsep
+#include <string.h>                 // memcpy, strsep
 #include <libacars/macros.h>        // la_assert, la_debug_print
-#include <libacars/util.h>          // LA_XCALLOC, LA_XFREE, LA_STRSEP
+#include <libacars/util.h>          // LA_XCALLOC, LA_XSTRDUP, LA_XFREE, LA_STRSEP
 #include <libacars/vstring.h>       // la_vstring
 
 #define LA_VSTR_INITIAL_SIZE 256
@@ -60,7 +60,7 @@ void la_isprintf_multiline_text(la_vstring *vstr, int indent, char const *txt) {
 		return;
 	}
 	// have to work on a copy, because strsep modifies its first argument
-	char *copy = strdup(txt);
+	char *copy = LA_XSTRDUP(txt);
 	char *ptr = copy;
 	char *line = NULL;
 	do {